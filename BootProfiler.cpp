@@ -0,0 +1,116 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::BootProfiler -- Boot phase timing and deferred setup
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BootProfiler.h"
+
+#include <Kaleidoscope-FocusSerial.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+uint32_t BootProfiler::times_[];
+uint32_t BootProfiler::first_keypress_;
+BootProfiler::Task BootProfiler::tasks_[];
+uint8_t BootProfiler::task_count_;
+HIDReportObserver::SendReportHook BootProfiler::previous_hook_;
+
+uint16_t BootProfiler::staticRam() {
+  return sizeof(times_) + sizeof(first_keypress_) + sizeof(tasks_) +
+         sizeof(task_count_) + sizeof(previous_hook_);
+}
+
+EventHandlerResult BootProfiler::onSetup() {
+  // Plugins that observe reports too, like KeyboardProtocol, chain to us
+  previous_hook_ = HIDReportObserver::resetHook(observeReport);
+  return EventHandlerResult::OK;
+}
+
+void BootProfiler::observeReport(uint8_t id, const void *data, int len, int result) {
+  if (previous_hook_)
+    previous_hook_(id, data, len, result);
+
+  if (!first_keypress_ && usbConfigured())
+    first_keypress_ = micros();
+}
+
+bool BootProfiler::defer(Task task) {
+  if (booted()) {
+    task();
+    return true;
+  }
+  if (task_count_ == max_tasks_)
+    return false;
+  tasks_[task_count_++] = task;
+  return true;
+}
+
+bool BootProfiler::usbConfigured() {
+#ifdef ARDUINO_SAMD_RAISE
+  return USBDevice.configured();
+#else
+  return true;
+#endif
+}
+
+EventHandlerResult BootProfiler::beforeEachCycle() {
+  if (booted())
+    return EventHandlerResult::OK;
+
+  if (!times_[USB_CONFIGURED] && usbConfigured())
+    mark(USB_CONFIGURED);
+
+  // Without a host (a power bank, say) don't hold the deferred work forever
+  if (!times_[USB_CONFIGURED] && Runtime.millisAtCycleStart() < usb_timeout_)
+    return EventHandlerResult::OK;
+
+  for (uint8_t i = 0; i < task_count_; i++)
+    tasks_[i]();
+  task_count_ = 0;
+  mark(DEFERRED_DONE);
+
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult BootProfiler::afterEachCycle() {
+  if (!times_[HOST_READY] && times_[USB_CONFIGURED])
+    mark(HOST_READY);
+
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult BootProfiler::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("boot.times\nboot.firstKeypress")))
+    return EventHandlerResult::OK;
+
+  if (strcmp_P(command, PSTR("boot.times")) == 0) {
+    for (uint8_t i = 0; i < PHASE_COUNT; i++)
+      ::Focus.send(times_[i]);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command, PSTR("boot.firstKeypress")) == 0) {
+    ::Focus.send(first_keypress_);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::BootProfiler BootProfiler;
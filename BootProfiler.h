@@ -0,0 +1,88 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::BootProfiler -- Boot phase timing and deferred setup
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+#include <HIDReportObserver.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * Records when each boot phase ended, in microseconds since reset, and runs
+ * the setup work that is not needed to type once the host has enumerated the
+ * keyboard (or once it gave up waiting for a host).
+ *
+ * HOST_READY is the end of the first cycle with the host listening, and the
+ * last phase: boot.times sends them all, in order.
+ *
+ * Reports are only sent when they change, so the first HID report the host
+ * gets, as HIDReportObserver sees it, comes with the first key press. Its
+ * time depends on the user, not the boot, so it is kept apart from the
+ * phases: boot.firstKeypress sends it, or 0 before any key was pressed.
+ */
+class BootProfiler: public Plugin {
+ public:
+  enum Phase : uint8_t {
+    SETUP_START,
+    KALEIDOSCOPE_SETUP,
+    STORAGE_RESERVED,
+    SETUP_DONE,
+    USB_CONFIGURED,
+    DEFERRED_DONE,
+    HOST_READY,
+    PHASE_COUNT
+  };
+
+  typedef void (*Task)();
+
+  EventHandlerResult onSetup();
+  EventHandlerResult beforeEachCycle();
+  EventHandlerResult afterEachCycle();
+  EventHandlerResult onFocusEvent(const char *command);
+
+  static void mark(Phase phase) {
+    times_[phase] = micros();
+  }
+  // Returns false, and drops the task, when max_tasks_ are already waiting
+  static bool defer(Task task);
+  static bool booted() {
+    return times_[DEFERRED_DONE] != 0;
+  }
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  static constexpr uint8_t max_tasks_ = 4;
+  static constexpr uint16_t usb_timeout_ = 1000;
+
+  static uint32_t times_[PHASE_COUNT];
+  static uint32_t first_keypress_;
+  static Task tasks_[max_tasks_];
+  static uint8_t task_count_;
+  static HIDReportObserver::SendReportHook previous_hook_;
+
+  static bool usbConfigured();
+  static void observeReport(uint8_t id, const void *data, int len, int result);
+};
+
+}
+}
+
+extern kaleidoscope::plugin::BootProfiler BootProfiler;
@@ -0,0 +1,54 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::ComboMasks -- Key combos, matched in constant time
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ComboMasks.h"
+
+namespace kaleidoscope {
+namespace plugin {
+
+static_assert(KeyAddr::upper_limit <= raise::combo_matcher::max_keys, "Too many keys for the combo bitmaps");
+
+raise::ComboMatcher ComboMasks::matcher_;
+
+uint16_t ComboMasks::staticRam() {
+  return sizeof(matcher_) + combo_masks::table_size;
+}
+
+EventHandlerResult ComboMasks::onSetup() {
+  matcher_.begin(combo_masks::combos, combo_masks::count, combo_masks::table, combo_masks::table_size);
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult ComboMasks::onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state) {
+  if (!key_addr.isValid())
+    return EventHandlerResult::OK;
+
+  if (keyToggledOn(key_state)) {
+    uint8_t index = matcher_.press(key_addr.toInt());
+    if (index != raise::ComboMatcher::no_combo)
+      combo_masks::combos[index].action(index);
+  } else if (keyToggledOff(key_state)) {
+    matcher_.release(key_addr.toInt());
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::ComboMasks ComboMasks;
@@ -0,0 +1,82 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::ComboMasks -- Key combos, matched in constant time
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+#include "ComboMatcher.h"
+
+/*
+ * The combos, in place of USE_MAGIC_COMBOS:
+ *
+ *   USE_COMBO_MASKS(
+ *     COMBO(toggleKeyboardProtocol, R4C0, R3C0, R4C2, R0C6),
+ *     COMBO(nextProfile, R4C0, R3C0, R4C2, R0C5)
+ *   );
+ *
+ * The key bitmaps and hashes are computed by the compiler.
+ */
+#define COMBO(action, ...) kaleidoscope::raise::combo_matcher::combo(action, __VA_ARGS__)
+
+#define USE_COMBO_MASKS(...)                                                        \
+  namespace kaleidoscope {                                                          \
+  namespace plugin {                                                                \
+  namespace combo_masks {                                                           \
+  const raise::ComboMatcher::Combo combos[] = {__VA_ARGS__};                        \
+  const uint8_t count = sizeof(combos) / sizeof(*combos);                           \
+  static_assert(sizeof(combos) / sizeof(*combos) <= 64, "Too many combos");         \
+  uint8_t table[raise::combo_matcher::tableSize(sizeof(combos) / sizeof(*combos))]; \
+  const uint8_t table_size = sizeof(table);                                         \
+  }                                                                                 \
+  }                                                                                 \
+  }
+
+namespace kaleidoscope {
+namespace plugin {
+
+namespace combo_masks {
+extern const raise::ComboMatcher::Combo combos[];
+extern const uint8_t count;
+extern uint8_t table[];
+extern const uint8_t table_size;
+}
+
+/*
+ * Runs the action of a combo when a press makes the held keys exactly that
+ * combo, once per press rather than again and again while it is held like
+ * MagicCombo does. The cost of a key event does not grow with the number of
+ * combos, and cycles without key events cost nothing.
+ *
+ * Put it early in KALEIDOSCOPE_INIT_PLUGINS, it has to see every press and
+ * release.
+ */
+class ComboMasks: public Plugin {
+ public:
+  EventHandlerResult onSetup();
+  EventHandlerResult onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state);
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  static raise::ComboMatcher matcher_;
+};
+
+}
+}
+
+extern kaleidoscope::plugin::ComboMasks ComboMasks;
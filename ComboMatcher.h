@@ -0,0 +1,163 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::raise::ComboMatcher -- Constant time key combo matching
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace kaleidoscope {
+namespace raise {
+
+/*
+ * Finds the combo whose keys are exactly the keys held, like MagicCombo, but
+ * without going through the combos one by one.
+ *
+ * Every combo is a bitmap of its keys, built at compile time by combo(),
+ * along with a hash: the XOR of a hash of each of its keys. The matcher keeps
+ * the same for the keys held, updated with a bit flip and an XOR on every
+ * press and release. The combos are placed in a small open addressing table
+ * by hash, so a press looks at one slot, rarely two, and compares a few
+ * words, however many combos there are.
+ */
+namespace combo_matcher {
+
+constexpr uint8_t max_keys = 96;
+constexpr uint8_t words = max_keys / 32;
+
+typedef void (*Action)(uint8_t combo_index);
+
+struct Combo {
+  Action action;
+  uint32_t mask[words];
+  uint32_t hash;
+  uint8_t length;
+};
+
+// The murmur3 finalizer, one step per function to stay within C++11 constexpr
+constexpr uint32_t mixShift(uint32_t h, uint8_t shift) {
+  return h ^ (h >> shift);
+}
+constexpr uint32_t keyHash(uint8_t key) {
+  return mixShift(mixShift(mixShift(key + 1u, 16) * 0x85ebca6bu, 13) * 0xc2b2ae35u, 16);
+}
+
+constexpr uint32_t maskWord(uint8_t) {
+  return 0;
+}
+template <typename... Keys>
+constexpr uint32_t maskWord(uint8_t word, int key, Keys... keys) {
+  return (key / 32 == word ? uint32_t(1) << (key % 32) : 0) | maskWord(word, keys...);
+}
+
+constexpr uint32_t hash() {
+  return 0;
+}
+template <typename... Keys>
+constexpr uint32_t hash(int key, Keys... keys) {
+  return keyHash(key) ^ hash(keys...);
+}
+
+// The keys are key indexes, like R4C0
+template <typename... Keys>
+constexpr Combo combo(Action action, Keys... keys) {
+  static_assert(sizeof...(keys) > 1 && sizeof...(keys) <= 0xff, "A combo needs two keys or more");
+  static_assert(words == 3, "Update the mask initializer below");
+  return Combo{action, {maskWord(0, keys...), maskWord(1, keys...), maskWord(2, keys...)},
+               hash(keys...), uint8_t(sizeof...(keys))};
+}
+
+// Slots for a table at most half full
+constexpr uint8_t tableSize(uint8_t combos, uint8_t size = 4) {
+  return size >= combos * 2 ? size : tableSize(combos, size * 2);
+}
+
+}
+
+class ComboMatcher {
+ public:
+  typedef combo_matcher::Combo Combo;
+
+  static constexpr uint8_t no_combo = 0xff;
+
+  void begin(const Combo *combos, uint8_t count, uint8_t *table, uint8_t table_size) {
+    combos_ = combos;
+    table_ = table;
+    table_mask_ = table_size - 1;
+    for (uint8_t i = 0; i < table_size; i++)
+      table_[i] = no_combo;
+
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t slot = combos_[i].hash & table_mask_;
+      while (table_[slot] != no_combo)
+        slot = (slot + 1) & table_mask_;
+      table_[slot] = i;
+    }
+  }
+
+  // Returns the combo the held keys are now, or no_combo
+  uint8_t press(uint8_t key) {
+    uint32_t bit = uint32_t(1) << (key % 32);
+    if (held_[key / 32] & bit)
+      return no_combo;
+    held_[key / 32] |= bit;
+    hash_ ^= combo_matcher::keyHash(key);
+    held_count_++;
+
+    if (held_count_ < 2 || !table_)
+      return no_combo;
+
+    for (uint8_t slot = hash_ & table_mask_; table_[slot] != no_combo; slot = (slot + 1) & table_mask_) {
+      const Combo &combo = combos_[table_[slot]];
+      if (combo.hash == hash_ && combo.length == held_count_ && matches(combo))
+        return table_[slot];
+    }
+    return no_combo;
+  }
+
+  void release(uint8_t key) {
+    uint32_t bit = uint32_t(1) << (key % 32);
+    if (!(held_[key / 32] & bit))
+      return;
+    held_[key / 32] &= ~bit;
+    hash_ ^= combo_matcher::keyHash(key);
+    held_count_--;
+  }
+
+  uint8_t heldCount() const {
+    return held_count_;
+  }
+
+ private:
+  const Combo *combos_ = nullptr;
+  uint8_t *table_ = nullptr;
+  uint8_t table_mask_ = 0;
+
+  uint32_t held_[combo_matcher::words] = {};
+  uint32_t hash_ = 0;
+  uint8_t held_count_ = 0;
+
+  bool matches(const Combo &combo) const {
+    for (uint8_t i = 0; i < combo_matcher::words; i++) {
+      if (combo.mask[i] != held_[i])
+        return false;
+    }
+    return true;
+  }
+};
+
+}
+}
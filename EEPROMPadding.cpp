@@ -23,7 +23,8 @@ namespace kaleidoscope {
 namespace plugin {
 
 EventHandlerResult EEPROMPadding::onSetup() {
-  ::EEPROMSettings.requestSlice(size_);
+  base_ = ::EEPROMSettings.requestSlice(size_);
+  return EventHandlerResult::OK;
 }
 
 }
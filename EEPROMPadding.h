@@ -28,8 +28,13 @@ class EEPROMPadding: public Plugin {
 
   EventHandlerResult onSetup();
 
+  uint16_t base() const {
+    return base_;
+  }
+
  private:
   uint16_t size_;
+  uint16_t base_ = 0;
 };
 
 }
@@ -0,0 +1,262 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::EEPROMScrubber -- Background EEPROM integrity checks
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EEPROMScrubber.h"
+
+#include <Kaleidoscope-EEPROM-Settings.h>
+#include <Kaleidoscope-FocusSerial.h>
+#include <Kaleidoscope-LEDControl.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+EEPROMScrubber::Range EEPROMScrubber::ranges_[];
+uint8_t EEPROMScrubber::range_count_;
+uint16_t EEPROMScrubber::settings_base_;
+uint8_t EEPROMScrubber::bytes_per_cycle_ = 8;
+bool EEPROMScrubber::active_;
+uint8_t EEPROMScrubber::led_mode_;
+uint32_t EEPROMScrubber::last_activity_;
+bool EEPROMScrubber::unsaved_;
+
+uint8_t EEPROMScrubber::current_;
+uint16_t EEPROMScrubber::position_;
+uint16_t EEPROMScrubber::crc_ = 0xffff;
+
+uint16_t EEPROMScrubber::passes_;
+uint32_t EEPROMScrubber::bytes_checked_;
+uint32_t EEPROMScrubber::pass_start_;
+uint32_t EEPROMScrubber::last_pass_time_;
+uint16_t EEPROMScrubber::max_cycle_time_;
+
+uint16_t EEPROMScrubber::staticRam() {
+  return sizeof(ranges_) + sizeof(range_count_) + sizeof(settings_base_) +
+         sizeof(bytes_per_cycle_) + sizeof(active_) + sizeof(led_mode_) +
+         sizeof(last_activity_) + sizeof(unsaved_) + sizeof(current_) +
+         sizeof(position_) + sizeof(crc_) + sizeof(passes_) +
+         sizeof(bytes_checked_) + sizeof(pass_start_) +
+         sizeof(last_pass_time_) + sizeof(max_cycle_time_);
+}
+
+void EEPROMScrubber::watch(uint16_t start, uint16_t end, Repair repair, const char *writers) {
+  if (range_count_ == max_ranges_ || start >= end)
+    return;
+  ranges_[range_count_++] = {start, end, repair, writers, unsealed_, false, 0};
+}
+
+void EEPROMScrubber::setup() {
+  settings_base_ = ::EEPROMSettings.requestSlice(max_ranges_ * sizeof(uint16_t));
+
+  for (uint8_t i = 0; i < range_count_; i++) {
+    Range &range = ranges_[i];
+    Runtime.storage().get(settings_base_ + i * sizeof(uint16_t), range.crc);
+    range.sealed = range.crc != unsealed_;
+  }
+  led_mode_ = ::LEDControl.get_mode_index();
+}
+
+void EEPROMScrubber::reseal(uint16_t address) {
+  for (uint8_t i = 0; i < range_count_; i++) {
+    const Range &range = ranges_[i];
+    if (address >= range.start && address < range.end) {
+      resealRange(i);
+      return;
+    }
+  }
+}
+
+void EEPROMScrubber::resealRange(uint8_t index) {
+  ranges_[index].sealed = false;
+  // Whatever was read of it so far may be stale
+  if (index == current_)
+    restart();
+}
+
+void EEPROMScrubber::resealAll() {
+  for (uint8_t i = 0; i < range_count_; i++)
+    ranges_[i].sealed = false;
+  restart();
+}
+
+void EEPROMScrubber::erase(uint16_t start, uint16_t end) {
+  for (uint16_t address = start; address < end; address++)
+    Runtime.storage().update(address, 0xff);
+  Runtime.storage().commit();
+}
+
+bool EEPROMScrubber::writes(const Range &range, const char *command) {
+  const char *writer = range.writers;
+  if (!writer)
+    return false;
+
+  uint8_t length = strlen(command);
+  while (pgm_read_byte(writer)) {
+    if (strncmp_P(command, writer, length) == 0) {
+      char end = pgm_read_byte(writer + length);
+      if (end == '\n' || end == '\0')
+        return true;
+    }
+    while (pgm_read_byte(writer) && pgm_read_byte(writer) != '\n')
+      writer++;
+    if (pgm_read_byte(writer))
+      writer++;
+  }
+  return false;
+}
+
+void EEPROMScrubber::restart() {
+  position_ = 0;
+  crc_ = 0xffff;
+}
+
+uint16_t EEPROMScrubber::crc16(uint16_t crc, uint8_t data) {
+  // CRC-16/CCITT, bit by bit: slower than a table, but no flash spent on one
+  crc ^= data << 8;
+  for (uint8_t bit = 0; bit < 8; bit++)
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  return crc;
+}
+
+void EEPROMScrubber::finish(uint8_t index) {
+  Range &range = ranges_[index];
+
+  if (range.sealed && crc_ != range.crc) {
+    range.errors++;
+    if (!range.repair)
+      return;
+    range.repair(range.start, range.end);
+    range.sealed = false;
+    // Checked again, and sealed, the next time around
+    return;
+  }
+
+  if (!range.sealed) {
+    range.crc = crc_;
+    range.sealed = true;
+    // The RAM copy only, see save_delay_
+    Runtime.storage().put(settings_base_ + index * sizeof(uint16_t), range.crc);
+    unsaved_ = true;
+  }
+}
+
+EventHandlerResult EEPROMScrubber::afterEachCycle() {
+  if (active_) {
+    active_ = false;
+    last_activity_ = Runtime.millisAtCycleStart();
+    return EventHandlerResult::OK;
+  }
+
+  // Saves the new CRCs, unless another plugin's commit already did
+  if (unsaved_ && Runtime.hasTimeExpired(last_activity_, save_delay_)) {
+    Runtime.storage().commit();
+    unsaved_ = false;
+    last_activity_ = Runtime.millisAtCycleStart();
+    return EventHandlerResult::OK;
+  }
+
+  if (!range_count_ || !bytes_per_cycle_)
+    return EventHandlerResult::OK;
+
+  uint16_t start = micros();
+  const Range &range = ranges_[current_];
+  uint16_t end = range.end - range.start;
+  if (end - position_ > bytes_per_cycle_)
+    end = position_ + bytes_per_cycle_;
+
+  bytes_checked_ += end - position_;
+  for (; position_ < end; position_++)
+    crc_ = crc16(crc_, Runtime.storage().read(range.start + position_));
+
+  if (position_ == range.end - range.start) {
+    finish(current_);
+    restart();
+    if (++current_ == range_count_) {
+      current_ = 0;
+      passes_++;
+      last_pass_time_ = Runtime.millisAtCycleStart() - pass_start_;
+      pass_start_ = Runtime.millisAtCycleStart();
+    }
+  }
+
+  uint16_t time = uint16_t(micros()) - start;
+  if (time > max_cycle_time_)
+    max_cycle_time_ = time;
+
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult EEPROMScrubber::onLEDModeChange() {
+  // Setting the same mode again, like waking up from idle, saves nothing
+  uint8_t mode = ::LEDControl.get_mode_index();
+  if (mode != led_mode_) {
+    led_mode_ = mode;
+    // However it was changed, it is saved where led.mode writes
+    for (uint8_t i = 0; i < range_count_; i++) {
+      if (writes(ranges_[i], "led.mode"))
+        resealRange(i);
+    }
+  }
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult EEPROMScrubber::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("eeprom.scrub\neeprom.scrubStats")))
+    return EventHandlerResult::OK;
+
+  if (strncmp_P(command, PSTR("eeprom.scrub"), 12) != 0) {
+    // We see every command before the plugin handling it writes anything
+    if (::Focus.isEOL())
+      return EventHandlerResult::OK;
+    if (strcmp_P(command, PSTR("eeprom.contents")) == 0) {
+      resealAll();
+      return EventHandlerResult::OK;
+    }
+    for (uint8_t i = 0; i < range_count_; i++) {
+      if (writes(ranges_[i], command))
+        resealRange(i);
+    }
+    return EventHandlerResult::OK;
+  }
+
+  if (command[12] == '\0') {
+    if (::Focus.isEOL())
+      ::Focus.send(bytes_per_cycle_);
+    else
+      ::Focus.read(bytes_per_cycle_);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 12, PSTR("Stats")) == 0) {
+    // Complete passes over every range, bytes checked since boot, how long
+    // the last pass took in milliseconds, and the most a cycle spent on
+    // checks in microseconds. Then for every range: start, end, whether it
+    // is sealed, and the failed checks.
+    ::Focus.send(passes_, bytes_checked_, last_pass_time_, max_cycle_time_);
+    for (uint8_t i = 0; i < range_count_; i++) {
+      const Range &range = ranges_[i];
+      ::Focus.send(range.start, range.end, range.sealed, range.errors);
+    }
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::EEPROMScrubber EEPROMScrubber;
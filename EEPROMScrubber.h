@@ -0,0 +1,121 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::EEPROMScrubber -- Background EEPROM integrity checks
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * Checks ranges of EEPROM slices against a CRC16 kept in a slice of its own,
+ * a few bytes at a time, at the end of cycles without key events. Going
+ * around every range takes a while, but no cycle pays more than
+ * bytes_per_cycle bytes of it.
+ *
+ * A range that fails its check is counted, and handed to its repair
+ * function, if it has one. After a repair, or any other legitimate write, the
+ * range is resealed: the next time around, its CRC is stored rather than
+ * checked. Code writing to a watched range calls reseal(). For plugins that
+ * do not know about the scrubber, a range can list the Focus commands that
+ * write to it: those reseal it when they come with arguments. eeprom.contents
+ * reseals everything, and an LED mode change, which PersistentLEDMode saves
+ * however it happens, reseals the ranges listing led.mode. A write that does
+ * not reseal shows up as a failure.
+ *
+ * A stored CRC of 0xffff, like an erased slice has, means "not sealed yet".
+ * New CRCs only go to the RAM copy of the EEPROM, so sealing never pays for a
+ * flash write: they are saved by the next commit of any plugin, or by one of
+ * our own once the keyboard has been idle for save_delay.
+ *
+ * eeprom.scrub reads or sets bytes_per_cycle, 0 pauses the checks.
+ * eeprom.scrubStats sends the coverage so far, then a line per range.
+ */
+class EEPROMScrubber: public Plugin {
+ public:
+  typedef void (*Repair)(uint16_t start, uint16_t end);
+
+  EventHandlerResult onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state) {
+    if (keyToggledOn(key_state) || keyToggledOff(key_state))
+      active_ = true;
+    return EventHandlerResult::OK;
+  }
+  EventHandlerResult afterEachCycle();
+  EventHandlerResult onLEDModeChange();
+  EventHandlerResult onFocusEvent(const char *command);
+
+  // Watches [start, end), call before setup(). writers is a PSTR list of
+  // Focus commands, one per line, that write to the range.
+  static void watch(uint16_t start, uint16_t end, Repair repair = nullptr, const char *writers = nullptr);
+  // Reserves the slice for the CRCs, after every range is watched
+  static void setup();
+
+  static void reseal(uint16_t address);
+  static void resealAll();
+
+  // A repair that puts the range back to erased, which most plugins read as their defaults
+  static void erase(uint16_t start, uint16_t end);
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  static constexpr uint8_t max_ranges_ = 8;
+  static constexpr uint16_t unsealed_ = 0xffff;
+  static constexpr uint16_t save_delay_ = 10000;
+
+  struct Range {
+    uint16_t start;
+    uint16_t end;
+    Repair repair;
+    const char *writers;
+    uint16_t crc;
+    bool sealed;
+    uint16_t errors;
+  };
+
+  static Range ranges_[max_ranges_];
+  static uint8_t range_count_;
+  static uint16_t settings_base_;
+  static uint8_t bytes_per_cycle_;
+  static bool active_;
+  static uint8_t led_mode_;
+  static uint32_t last_activity_;
+  static bool unsaved_;
+
+  static uint8_t current_;
+  static uint16_t position_;
+  static uint16_t crc_;
+
+  static uint16_t passes_;
+  static uint32_t bytes_checked_;
+  static uint32_t pass_start_;
+  static uint32_t last_pass_time_;
+  static uint16_t max_cycle_time_;
+
+  static void restart();
+  static void resealRange(uint8_t index);
+  static bool writes(const Range &range, const char *command);
+  static void finish(uint8_t index);
+  static uint16_t crc16(uint16_t crc, uint8_t data);
+};
+
+}
+}
+
+extern kaleidoscope::plugin::EEPROMScrubber EEPROMScrubber;
@@ -0,0 +1,94 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::FocusBuffer -- Packet sized buffering of Focus replies
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FocusBuffer.h"
+#include <Kaleidoscope-FocusSerial.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+uint8_t FocusBuffer::buffer_[packet_size_];
+uint8_t FocusBuffer::used_;
+bool FocusBuffer::enabled_ = true;
+
+uint16_t FocusBuffer::staticRam() {
+  return sizeof(buffer_) + sizeof(used_) + sizeof(enabled_);
+}
+
+size_t FocusBuffer::write(uint8_t c) {
+  if (!enabled_)
+    return Runtime.serialPort().write(c);
+
+  buffer_[used_++] = c;
+  if (used_ == packet_size_)
+    flush();
+  return 1;
+}
+
+size_t FocusBuffer::write(const uint8_t *data, size_t size) {
+  if (!enabled_)
+    return Runtime.serialPort().write(data, size);
+
+  for (size_t i = 0; i < size; i++)
+    write(data[i]);
+  return size;
+}
+
+void FocusBuffer::flush() {
+  if (used_ == 0)
+    return;
+  Runtime.serialPort().write(buffer_, used_);
+  used_ = 0;
+}
+
+void FocusBuffer::enable(bool enabled) {
+  flush();
+  enabled_ = enabled;
+}
+
+EventHandlerResult FocusBuffer::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("focus.buffer")))
+    return EventHandlerResult::OK;
+
+  if (strcmp_P(command, PSTR("eeprom.contents")) == 0) {
+    if (!::Focus.isEOL())
+      return EventHandlerResult::OK;
+
+    for (uint16_t i = 0; i < Runtime.storage().length(); i++)
+      send(Runtime.storage().read(i));
+    flush();
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command, PSTR("focus.buffer")) != 0)
+    return EventHandlerResult::OK;
+
+  if (::Focus.isEOL()) {
+    ::Focus.send(enabled_);
+  } else {
+    uint8_t enabled;
+    ::Focus.read(enabled);
+    enable(enabled);
+  }
+
+  return EventHandlerResult::EVENT_CONSUMED;
+}
+
+}
+}
+
+kaleidoscope::plugin::FocusBuffer FocusBuffer;
@@ -0,0 +1,77 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::FocusBuffer -- Packet sized buffering of Focus replies
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * Every Focus.send() or serialPort().write() of a single value can end up as
+ * its own USB CDC transfer, which makes replies of a few thousand values very
+ * slow. FocusBuffer collects the reply and hands it to the serial port one full
+ * USB packet at a time.
+ *
+ * Use send() for text replies (the same format as Focus.send()) and write()
+ * for binary ones, and call flush() before returning from onFocusEvent(), so
+ * the reply goes out before the terminator Focus sends after it.
+ *
+ * It also serves eeprom.contents reads, so it has to come before
+ * FocusEEPROMCommand in KALEIDOSCOPE_INIT_PLUGINS. Writes are left to
+ * FocusEEPROMCommand.
+ */
+class FocusBuffer: public Plugin, public Print {
+ public:
+  EventHandlerResult onFocusEvent(const char *command);
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *data, size_t size) override;
+  using Print::write;
+  void flush();
+
+  void send() {}
+  template <typename V, typename... Vs>
+  void send(V value, Vs... values) {
+    print(value);
+    write(' ');
+    send(values...);
+  }
+
+  // With buffering disabled every write goes straight to the serial port
+  static void enable(bool enabled);
+  static bool enabled() {
+    return enabled_;
+  }
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  // Bulk endpoint size of the USB CDC interface
+  static constexpr uint8_t packet_size_ = 64;
+
+  static uint8_t buffer_[packet_size_];
+  static uint8_t used_;
+  static bool enabled_;
+};
+
+}
+}
+
+extern kaleidoscope::plugin::FocusBuffer FocusBuffer;
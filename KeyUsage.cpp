@@ -0,0 +1,145 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::KeyUsage -- Per-key press counters for heatmaps
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "KeyUsage.h"
+#include "EEPROMScrubber.h"
+#include "FocusBuffer.h"
+
+#include <Kaleidoscope-EEPROM-Settings.h>
+#include <Kaleidoscope-FocusSerial.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+uint16_t KeyUsage::counts_[];
+uint16_t KeyUsage::settings_base_;
+bool KeyUsage::active_;
+bool KeyUsage::dirty_;
+uint32_t KeyUsage::last_activity_;
+uint32_t KeyUsage::last_flush_;
+bool KeyUsage::flushed_;
+
+uint16_t KeyUsage::staticRam() {
+  return sizeof(counts_) + sizeof(settings_base_) + sizeof(active_) +
+         sizeof(dirty_) + sizeof(last_activity_) + sizeof(last_flush_) +
+         sizeof(flushed_);
+}
+
+void KeyUsage::setup() {
+  settings_base_ = ::EEPROMSettings.requestSlice(sizeof(version_) + sizeof(counts_));
+
+  // A new or erased slice starts from zero
+  if (Runtime.storage().read(settings_base_) == version_)
+    Runtime.storage().get(settings_base_ + sizeof(version_), counts_);
+}
+
+void KeyUsage::flush() {
+  Runtime.storage().update(settings_base_, version_);
+  Runtime.storage().put(settings_base_ + sizeof(version_), counts_);
+  Runtime.storage().commit();
+  ::EEPROMScrubber.reseal(settings_base_);
+  dirty_ = false;
+  flushed_ = true;
+  last_flush_ = Runtime.millisAtCycleStart();
+}
+
+EventHandlerResult KeyUsage::afterEachCycle() {
+  if (active_) {
+    active_ = false;
+    dirty_ = true;
+    last_activity_ = Runtime.millisAtCycleStart();
+    return EventHandlerResult::OK;
+  }
+
+  // The first save after boot does not wait for the interval, or a keyboard
+  // unplugged every evening would never save anything
+  if (dirty_ &&
+      Runtime.hasTimeExpired(last_activity_, idle_time_) &&
+      (!flushed_ || Runtime.hasTimeExpired(last_flush_, flush_interval_)))
+    flush();
+
+  return EventHandlerResult::OK;
+}
+
+uint32_t KeyUsage::measureCost() {
+  constexpr uint16_t rounds = 10000;
+  KeyAddr key_addr(0);
+  uint16_t saved = counts_[key_addr.toInt()];
+  bool was_active = active_;
+  Key key = Key_NoKey;
+  // Read anew every round, so the compiler cannot fold the rounds into one
+  volatile uint8_t key_state = IS_PRESSED;
+  volatile uint16_t sink;
+
+  // The loop itself, without the counting
+  uint32_t start = micros();
+  for (uint16_t i = 0; i < rounds; i++)
+    sink = key_state;
+  uint32_t empty = micros() - start;
+
+  // The whole event handler, as a key press goes through it
+  start = micros();
+  for (uint16_t i = 0; i < rounds; i++) {
+    ::KeyUsage.onKeyswitchEvent(key, key_addr, key_state);
+    sink = counts_[key_addr.toInt()];
+  }
+  uint32_t counting = micros() - start;
+  (void)sink;
+
+  counts_[key_addr.toInt()] = saved;
+  active_ = was_active;
+  return (counting - empty) * (F_CPU / 1000000) / rounds;
+}
+
+EventHandlerResult KeyUsage::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("stats.keys\nstats.keysClear\nstats.keysCost")))
+    return EventHandlerResult::OK;
+
+  if (strncmp_P(command, PSTR("stats.keys"), 10) != 0)
+    return EventHandlerResult::OK;
+
+  if (command[10] == '\0') {
+    for (uint8_t i = 0; i < KeyAddr::upper_limit; i++) {
+      ::FocusBuffer.write(counts_[i] & 0xff);
+      ::FocusBuffer.write(counts_[i] >> 8);
+    }
+    ::FocusBuffer.flush();
+    // Someone looks at them, a good time to keep them
+    if (dirty_)
+      flush();
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 10, PSTR("Clear")) == 0) {
+    memset(counts_, 0, sizeof(counts_));
+    flush();
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 10, PSTR("Cost")) == 0) {
+    // CPU cycles to count one press
+    ::Focus.send(measureCost());
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::KeyUsage KeyUsage;
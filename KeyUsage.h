@@ -0,0 +1,87 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::KeyUsage -- Per-key press counters for heatmaps
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * Counts the presses of every physical key, in 16 bit counters that stop at
+ * their maximum. Counting a press is an increment in RAM. The counters are
+ * saved to EEPROM in one go when the host reads or clears them, and otherwise
+ * only once the keyboard has been idle for a while: the first time after boot
+ * right away, then at most every six hours.
+ *
+ * Every save rewrites the flash the EEPROM is emulated in, which the SAMD21
+ * is rated for 25000 times. Left plugged in and typed on all day, that is
+ * five saves a day from this plugin, some 1800 a year. Counts since the last
+ * save are lost on unplugging.
+ *
+ * stats.keys sends every counter as a little-endian uint16, in KeyAddr order,
+ * as binary. stats.keysClear zeroes them, and stats.keysCost measures how many
+ * CPU cycles counting one press takes.
+ */
+class KeyUsage: public Plugin {
+ public:
+  EventHandlerResult onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state) {
+    if (keyToggledOn(key_state) && key_addr.isValid()) {
+      count(key_addr);
+      active_ = true;
+    }
+    return EventHandlerResult::OK;
+  }
+  EventHandlerResult afterEachCycle();
+  EventHandlerResult onFocusEvent(const char *command);
+
+  // Reserves the EEPROM slice and loads the saved counters
+  static void setup();
+
+  static uint16_t presses(KeyAddr key_addr) {
+    return counts_[key_addr.toInt()];
+  }
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  static constexpr uint8_t version_ = 1;
+  static constexpr uint16_t idle_time_ = 10000;
+  static constexpr uint32_t flush_interval_ = 6 * 60 * 60 * 1000UL;
+
+  static uint16_t counts_[KeyAddr::upper_limit];
+  static uint16_t settings_base_;
+  static bool active_;
+  static bool dirty_;
+  static uint32_t last_activity_;
+  static uint32_t last_flush_;
+  static bool flushed_;
+
+  static void count(KeyAddr key_addr) {
+    uint16_t &counter = counts_[key_addr.toInt()];
+    counter += counter != 0xffff;
+  }
+  static void flush();
+  static uint32_t measureCost();
+};
+
+}
+}
+
+extern kaleidoscope::plugin::KeyUsage KeyUsage;
@@ -0,0 +1,244 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::KeyboardProtocol -- Persistent NKRO / boot protocol switch
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "KeyboardProtocol.h"
+#include "LEDFrameScheduler.h"
+#include "EEPROMScrubber.h"
+
+#include <Kaleidoscope-EEPROM-Settings.h>
+#include <Kaleidoscope-FocusSerial.h>
+#include <Kaleidoscope-LEDControl.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+uint16_t KeyboardProtocol::settings_base_;
+uint8_t KeyboardProtocol::pending_protocol_ = KeyboardProtocol::no_protocol_;
+
+KeyAddr KeyboardProtocol::feedback_keys_[];
+uint32_t KeyboardProtocol::feedback_start_;
+bool KeyboardProtocol::feedback_;
+
+bool KeyboardProtocol::incremental_ = true;
+
+uint32_t KeyboardProtocol::build_start_;
+bool KeyboardProtocol::building_;
+bool KeyboardProtocol::key_event_;
+uint32_t KeyboardProtocol::keystrokes_;
+uint32_t KeyboardProtocol::reports_;
+uint32_t KeyboardProtocol::measured_reports_;
+uint32_t KeyboardProtocol::total_report_time_;
+uint16_t KeyboardProtocol::max_report_time_;
+HIDReportObserver::SendReportHook KeyboardProtocol::previous_hook_;
+
+uint16_t KeyboardProtocol::staticRam() {
+  return sizeof(settings_base_) + sizeof(pending_protocol_) +
+         sizeof(feedback_keys_) + sizeof(feedback_start_) + sizeof(feedback_) +
+         sizeof(incremental_) + sizeof(build_start_) + sizeof(building_) + sizeof(key_event_) +
+         sizeof(keystrokes_) + sizeof(reports_) +
+         sizeof(measured_reports_) + sizeof(total_report_time_) +
+         sizeof(max_report_time_) + sizeof(previous_hook_);
+}
+
+void KeyboardProtocol::setup() {
+  settings_base_ = ::EEPROMSettings.requestSlice(sizeof(uint8_t));
+  previous_hook_ = HIDReportObserver::resetHook(observeReport);
+
+  // An erased slice keeps the default protocol
+  uint8_t saved = Runtime.storage().read(settings_base_);
+  if (saved == HID_BOOT_PROTOCOL || saved == HID_REPORT_PROTOCOL) {
+    Runtime.hid().keyboard().setDefaultProtocol(saved);
+    Runtime.hid().keyboard().setProtocol(saved);
+  }
+}
+
+uint8_t KeyboardProtocol::protocol() {
+  if (pending_protocol_ != no_protocol_)
+    return pending_protocol_;
+  return Runtime.hid().keyboard().getProtocol();
+}
+
+void KeyboardProtocol::protocol(uint8_t protocol) {
+  if (protocol == KeyboardProtocol::protocol())
+    return;
+
+  Runtime.storage().update(settings_base_, protocol);
+  Runtime.storage().commit();
+  ::EEPROMScrubber.reseal(settings_base_);
+  // Applied in afterEachCycle()
+  pending_protocol_ = protocol;
+}
+
+void KeyboardProtocol::toggle() {
+  // The keys held right now are the ones that triggered the switch
+  uint8_t count = 0;
+  for (auto key_addr : KeyAddr::all()) {
+    if (count < max_feedback_keys_ && Runtime.device().isKeyswitchPressed(key_addr))
+      feedback_keys_[count++] = key_addr;
+  }
+  while (count < max_feedback_keys_)
+    feedback_keys_[count++] = KeyAddr(KeyAddr::invalid_state);
+
+  protocol(protocol() == HID_BOOT_PROTOCOL ? HID_REPORT_PROTOCOL : HID_BOOT_PROTOCOL);
+
+  feedback_start_ = Runtime.millisAtCycleStart();
+  feedback_ = true;
+}
+
+void KeyboardProtocol::apply(uint8_t protocol) {
+  // Same dance as USBQuirks: the host has to enumerate us again
+  Runtime.detachFromHost();
+  Runtime.hid().keyboard().setDefaultProtocol(protocol);
+  Runtime.hid().keyboard().setProtocol(protocol);
+  delay(1000);
+  Runtime.attachToHost();
+
+  resetStats();
+}
+
+void KeyboardProtocol::resetStats() {
+  keystrokes_ = 0;
+  reports_ = 0;
+  measured_reports_ = 0;
+  total_report_time_ = 0;
+  max_report_time_ = 0;
+}
+
+void KeyboardProtocol::observeReport(uint8_t id, const void *data, int len, int result) {
+  if (previous_hook_)
+    previous_hook_(id, data, len, result);
+
+  if (id != HID_REPORTID_KEYBOARD && id != HID_REPORTID_NKRO_KEYBOARD)
+    return;
+
+  reports_++;
+  if (!key_event_)
+    return;
+
+  // Only the first report of a cycle with key events is measured
+  key_event_ = false;
+  uint16_t time = micros() - build_start_;
+  measured_reports_++;
+  total_report_time_ += time;
+  if (time > max_report_time_)
+    max_report_time_ = time;
+}
+
+EventHandlerResult KeyboardProtocol::beforeEachCycle() {
+  building_ = false;
+  key_event_ = false;
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult KeyboardProtocol::onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state) {
+  // The scan is done, the report is being built from here on
+  if (!building_) {
+    building_ = true;
+    build_start_ = micros();
+  }
+  if (keyToggledOn(key_state) || keyToggledOff(key_state))
+    key_event_ = true;
+  if (keyToggledOn(key_state))
+    keystrokes_++;
+
+  // Held since an earlier cycle, nothing changed: just put it back
+  if (incremental_ && keyIsPressed(key_state) && keyWasPressed(key_state) &&
+      key_addr.isValid() && !(key_state & INJECTED) &&
+      mapped_key.getFlags() == 0 && mapped_key != Key_NoKey) {
+    Runtime.hid().keyboard().pressKey(mapped_key, false);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult KeyboardProtocol::beforeReportingState() {
+  if (!feedback_ || !::LEDFrameScheduler.isFrameCycle())
+    return EventHandlerResult::OK;
+
+  bool done = Runtime.hasTimeExpired(feedback_start_, feedback_time_);
+  cRGB color = breath_compute(protocol() == HID_BOOT_PROTOCOL ? 0 : 120);
+
+  for (uint8_t i = 0; i < max_feedback_keys_; i++) {
+    if (!feedback_keys_[i].isValid())
+      continue;
+    if (done)
+      ::LEDControl.refreshAt(feedback_keys_[i]);
+    else
+      ::LEDControl.setCrgbAt(feedback_keys_[i], color);
+  }
+  feedback_ = !done;
+
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult KeyboardProtocol::afterEachCycle() {
+  if (pending_protocol_ != no_protocol_) {
+    uint8_t protocol = pending_protocol_;
+    pending_protocol_ = no_protocol_;
+    apply(protocol);
+  }
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult KeyboardProtocol::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("hid.protocol\nhid.incremental\nhid.reportStats")))
+    return EventHandlerResult::OK;
+
+  if (strncmp_P(command, PSTR("hid."), 4) != 0)
+    return EventHandlerResult::OK;
+
+  if (strcmp_P(command + 4, PSTR("protocol")) == 0) {
+    // 0: boot, 1: NKRO
+    if (::Focus.isEOL()) {
+      ::Focus.send(protocol());
+    } else {
+      uint8_t new_protocol;
+      ::Focus.read(new_protocol);
+      if (new_protocol == HID_BOOT_PROTOCOL || new_protocol == HID_REPORT_PROTOCOL)
+        protocol(new_protocol);
+    }
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 4, PSTR("incremental")) == 0) {
+    if (::Focus.isEOL()) {
+      ::Focus.send(incremental_);
+    } else {
+      uint8_t incremental;
+      ::Focus.read(incremental);
+      incremental_ = incremental;
+      resetStats();
+    }
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 4, PSTR("reportStats")) == 0) {
+    // Since the last switch of protocol or path: protocol, keystrokes, keyboard reports sent,
+    // average and worst time in microseconds to build and send the report of
+    // a cycle with key events
+    ::Focus.send(protocol(), keystrokes_, reports_);
+    ::Focus.send(measured_reports_ ? total_report_time_ / measured_reports_ : 0, max_report_time_);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::KeyboardProtocol KeyboardProtocol;
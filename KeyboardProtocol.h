@@ -0,0 +1,105 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::KeyboardProtocol -- Persistent NKRO / boot protocol switch
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+#include <HIDReportObserver.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * Switches the keyboard between the NKRO (report) and the 6KRO (boot)
+ * protocol, and remembers the choice in EEPROM. After a switch the keys held
+ * to trigger it breathe for a while, green for NKRO and red for boot.
+ *
+ * It also measures the keyboard report path, so both protocols can be
+ * compared: how many reports go out per keystroke, and how long building a
+ * report takes, from the first keyswitch event Kaleidoscope hands the plugins
+ * in a cycle with a key change, to the report being sent. The matrix scan
+ * before it is not counted.
+ *
+ * Kaleidoscope clears the report every cycle, then hands every held key to
+ * every plugin again to fill it back in. KeyboardioHID then sends the report
+ * only when it differs from the last one sent. With the incremental path on,
+ * the default, only key changes take that long way. A plain keyboard key
+ * held since an earlier cycle goes straight back into the report from here,
+ * and the plugins after this one do not see it. Its key code was already
+ * looked up when it was pressed. Layer, synthetic and injected keys still go
+ * through every plugin. Plugins that act on held keys, not on presses and
+ * releases, stop seeing them: Stalker lets a held key fade, and holding a
+ * key alone no longer keeps the LEDs from idling. hid.incremental turns the
+ * path off (0) or on (1), and hid.reportStats compares the two.
+ *
+ * A new protocol is applied at the end of the cycle it was chosen in, after a
+ * Focus reply went out: applying it makes the host enumerate us again.
+ *
+ * Put it first in KALEIDOSCOPE_INIT_PLUGINS, so its onKeyswitchEvent() sees
+ * the first key of every cycle.
+ */
+class KeyboardProtocol: public Plugin {
+ public:
+  EventHandlerResult beforeEachCycle();
+  EventHandlerResult onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state);
+  EventHandlerResult beforeReportingState();
+  EventHandlerResult afterEachCycle();
+  EventHandlerResult onFocusEvent(const char *command);
+
+  // Reserves the EEPROM slice and switches to the saved protocol
+  static void setup();
+
+  static uint8_t protocol();
+  static void protocol(uint8_t protocol);
+  static void toggle();
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  static constexpr uint8_t max_feedback_keys_ = 4;
+  static constexpr uint16_t feedback_time_ = 10000;
+  static constexpr uint8_t no_protocol_ = 0xff;
+
+  static uint16_t settings_base_;
+  static uint8_t pending_protocol_;
+
+  static KeyAddr feedback_keys_[max_feedback_keys_];
+  static uint32_t feedback_start_;
+  static bool feedback_;
+
+  static bool incremental_;
+
+  static uint32_t build_start_;
+  static bool building_;
+  static bool key_event_;
+  static uint32_t keystrokes_;
+  static uint32_t reports_;
+  static uint32_t measured_reports_;
+  static uint32_t total_report_time_;
+  static uint16_t max_report_time_;
+  static HIDReportObserver::SendReportHook previous_hook_;
+
+  static void apply(uint8_t protocol);
+  static void resetStats();
+  static void observeReport(uint8_t id, const void *data, int len, int result);
+};
+
+}
+}
+
+extern kaleidoscope::plugin::KeyboardProtocol KeyboardProtocol;
@@ -1,5 +1,5 @@
 /* -*- mode: c++ -*-
- * kaleidoscope::plugin::LEDCapsLockLight -- Highlight CapsLock when active
+ * kaleidoscope::plugin::LEDCapsLockLight -- Highlight the host lock keys when active
  * Copyright (C) 2020  Dygma Lab S.L.
  *
  * This program is free software: you can redistribute it and/or modify it under
@@ -16,48 +16,130 @@
  */
 
 #include "LED-CapsLockLight.h"
+#include "LEDFrameScheduler.h"
+
+#include <Kaleidoscope-FocusSerial.h>
 
 namespace kaleidoscope {
 namespace plugin {
 
-KeyAddr LEDCapsLockLight::caps_address_ = UnknownKeyswitchLocation;
-uint8_t LEDCapsLockLight::highlight_hue_ = 0;
-bool LEDCapsLockLight::caps_was_on_;
+const uint8_t LEDCapsLockLight::indicator_leds_[] = {
+  LED_NUM_LOCK, LED_CAPS_LOCK, LED_SCROLL_LOCK, LED_COMPOSE
+};
+const Key LEDCapsLockLight::indicator_keys_[] = {
+  Key_KeypadNumLock, Key_CapsLock, Key_ScrollLock, Key_PcApplication
+};
+const uint8_t LEDCapsLockLight::indicator_hues_[] = {
+  85, 0, 170, 42
+};
+
+KeyAddr LEDCapsLockLight::addresses_[];
+cRGB LEDCapsLockLight::colors_[];
+uint32_t LEDCapsLockLight::layer_state_;
+uint8_t LEDCapsLockLight::leds_were_on_;
+uint8_t LEDCapsLockLight::phase_;
+bool LEDCapsLockLight::rescan_;
+
+uint16_t LEDCapsLockLight::staticRam() {
+  return sizeof(addresses_) + sizeof(colors_) + sizeof(layer_state_) +
+         sizeof(leds_were_on_) + sizeof(phase_) + sizeof(rescan_);
+}
 
 EventHandlerResult LEDCapsLockLight::onSetup() {
-  return findCapsLock();
+  // The sketch sets the EEPROM keymap up after this, look on the first frame
+  rescan_ = true;
+  return EventHandlerResult::OK;
 }
 
 EventHandlerResult LEDCapsLockLight::onLayerChange() {
-  return findCapsLock();
+  return findIndicators();
 }
 
 EventHandlerResult LEDCapsLockLight::beforeReportingState() {
-  if (!caps_address_.isValid())
+  if (!::LEDFrameScheduler.isFrameCycle())
     return EventHandlerResult::OK;
 
-  bool caps_is_on = !!(Runtime.hid().keyboard().getKeyboardLEDs() & LED_CAPS_LOCK);
-
-  if (!caps_is_on && caps_was_on_) {
-    ::LEDControl.refreshAt(caps_address_);
+  if (rescan_) {
+    rescan_ = false;
+    layer_state_ = ~Layer.getLayerState();
+    findIndicators();
   }
-  if (caps_is_on) {
-    cRGB color = breath_compute(highlight_hue_);
-    ::LEDControl.setCrgbAt(caps_address_, color);
+
+  uint8_t leds_are_on = Runtime.hid().keyboard().getKeyboardLEDs();
+
+  // breath_compute() moves to its next step every 16ms
+  uint8_t phase = Runtime.millisAtCycleStart() >> 4;
+  bool phase_changed = phase != phase_;
+  phase_ = phase;
+
+  if (leds_are_on == 0 && leds_were_on_ == 0)
+    return EventHandlerResult::OK;
+
+  for (uint8_t i = 0; i < indicator_count_; i++) {
+    if (!addresses_[i].isValid())
+      continue;
+
+    bool is_on = leds_are_on & indicator_leds_[i];
+    bool was_on = leds_were_on_ & indicator_leds_[i];
+
+    if (!is_on) {
+      if (was_on)
+        ::LEDControl.refreshAt(addresses_[i]);
+      continue;
+    }
+
+    if (phase_changed || !was_on)
+      colors_[i] = breath_compute(indicator_hues_[i]);
+
+    cRGB shown = ::LEDControl.getCrgbAt(addresses_[i]);
+    if (shown.r != colors_[i].r || shown.g != colors_[i].g || shown.b != colors_[i].b)
+      ::LEDControl.setCrgbAt(addresses_[i], colors_[i]);
   }
-  caps_was_on_ = caps_is_on;
+
+  leds_were_on_ = leds_are_on;
   return EventHandlerResult::OK;
 }
 
-EventHandlerResult LEDCapsLockLight::findCapsLock() {
-  caps_address_ = UnknownKeyswitchLocation;
+EventHandlerResult LEDCapsLockLight::onFocusEvent(const char *command) {
+  // Same layers, different keys: look again once the command is done
+  if (!::Focus.isEOL() &&
+      (strncmp_P(command, PSTR("keymap."), 7) == 0 || strcmp_P(command, PSTR("eeprom.contents")) == 0))
+    rescan_ = true;
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult LEDCapsLockLight::findIndicators() {
+  if (Layer.getLayerState() == layer_state_)
+    return EventHandlerResult::OK;
+  layer_state_ = Layer.getLayerState();
+
+  uint8_t found = 0;
+  KeyAddr addresses[indicator_count_];
+  for (uint8_t i = 0; i < indicator_count_; i++)
+    addresses[i] = UnknownKeyswitchLocation;
 
   for (auto key_addr: KeyAddr::all()) {
     Key k = Layer.lookup(key_addr);
-    if (k == Key_CapsLock) {
-      caps_address_ = key_addr;
-      break;
+    for (uint8_t i = 0; i < indicator_count_; i++) {
+      if (k == indicator_keys_[i] && !addresses[i].isValid()) {
+        addresses[i] = key_addr;
+        found++;
+      }
     }
+    if (found == indicator_count_)
+      break;
+  }
+
+  for (uint8_t i = 0; i < indicator_count_; i++) {
+    if (addresses_[i] == addresses[i])
+      continue;
+
+    // Give a highlighted key that moved away its normal color back, and
+    // forget it was lit so it gets painted at its new place.
+    if (addresses_[i].isValid() && (leds_were_on_ & indicator_leds_[i]))
+      ::LEDControl.refreshAt(addresses_[i]);
+    leds_were_on_ &= ~indicator_leds_[i];
+    addresses_[i] = addresses[i];
   }
 
   return EventHandlerResult::OK;
@@ -1,5 +1,5 @@
 /* -*- mode: c++ -*-
- * kaleidoscope::plugin::LEDCapsLockLight -- Highlight CapsLock when active
+ * kaleidoscope::plugin::LEDCapsLockLight -- Highlight the host lock keys when active
  * Copyright (C) 2020  Dygma Lab S.L.
  *
  * This program is free software: you can redistribute it and/or modify it under
@@ -23,18 +23,40 @@
 namespace kaleidoscope {
 namespace plugin {
 
+/*
+ * Highlights the Num Lock, Caps Lock, Scroll Lock and Compose keys while the
+ * host has the matching LED turned on. The key addresses are cached and only
+ * looked up again when the layer state changes, or on the next frame after a
+ * Focus command rewrote the keymap. Those commands are handled by plugins
+ * earlier in the list than this one is placed, so it has to be listed before
+ * them to see them. An indicator is only repainted when the host LED state or
+ * the breathing phase changes (or when an LED effect painted over it).
+ */
 class LEDCapsLockLight: public Plugin {
  public:
   EventHandlerResult onSetup();
   EventHandlerResult onLayerChange();
   EventHandlerResult beforeReportingState();
+  EventHandlerResult onFocusEvent(const char *command);
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
 
  private:
-  static KeyAddr caps_address_;
-  static uint8_t highlight_hue_;
-  static bool caps_was_on_;
+  static constexpr uint8_t indicator_count_ = 4;
+
+  static const uint8_t indicator_leds_[indicator_count_];
+  static const Key indicator_keys_[indicator_count_];
+  static const uint8_t indicator_hues_[indicator_count_];
+
+  static KeyAddr addresses_[indicator_count_];
+  static cRGB colors_[indicator_count_];
+  static uint32_t layer_state_;
+  static uint8_t leds_were_on_;
+  static uint8_t phase_;
+  static bool rescan_;
 
-  static EventHandlerResult findCapsLock();
+  static EventHandlerResult findIndicators();
 };
 
 }
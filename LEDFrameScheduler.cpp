@@ -0,0 +1,127 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::LEDFrameScheduler -- Fixed-rate LED frames
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LEDFrameScheduler.h"
+
+#include <Kaleidoscope-LEDControl.h>
+#include <Kaleidoscope-FocusSerial.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+uint8_t LEDFrameScheduler::fps_ = 40;
+uint16_t LEDFrameScheduler::frame_interval_ = 1000 / 40;
+uint16_t LEDFrameScheduler::frame_start_;
+bool LEDFrameScheduler::frame_cycle_;
+bool LEDFrameScheduler::paused_;
+
+uint16_t LEDFrameScheduler::measure_start_;
+uint32_t LEDFrameScheduler::cycles_;
+uint8_t LEDFrameScheduler::frames_;
+uint32_t LEDFrameScheduler::scan_rate_;
+uint8_t LEDFrameScheduler::frame_rate_;
+
+uint16_t LEDFrameScheduler::staticRam() {
+  return sizeof(fps_) + sizeof(frame_interval_) + sizeof(frame_start_) +
+         sizeof(frame_cycle_) + sizeof(paused_) + sizeof(measure_start_) +
+         sizeof(cycles_) + sizeof(frames_) + sizeof(scan_rate_) +
+         sizeof(frame_rate_);
+}
+
+void LEDFrameScheduler::fps(uint8_t fps) {
+  if (fps == 0)
+    fps = 1;
+  fps_ = fps;
+  frame_interval_ = 1000 / fps_;
+}
+
+EventHandlerResult LEDFrameScheduler::onSetup() {
+  /*
+   * We do the syncing ourselves, on frame cycles only. Push LEDControl's own
+   * sync timer out of reach: hasTimeExpired() can never see more than 0xffff
+   * milliseconds pass on a 16 bit timer.
+   */
+  ::LEDControl.syncDelay = 0xffff;
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult LEDFrameScheduler::beforeEachCycle() {
+  cycles_++;
+
+  frame_cycle_ = !paused_ && Runtime.hasTimeExpired(frame_start_, frame_interval_);
+  if (frame_cycle_)
+    frame_start_ = Runtime.millisAtCycleStart();
+
+  if (Runtime.hasTimeExpired(measure_start_, measure_window_)) {
+    scan_rate_ = cycles_;
+    frame_rate_ = frames_;
+    cycles_ = 0;
+    frames_ = 0;
+    measure_start_ = Runtime.millisAtCycleStart();
+  }
+
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult LEDFrameScheduler::afterEachCycle() {
+  if (!frame_cycle_)
+    return EventHandlerResult::OK;
+
+  /*
+   * Same order as LEDControl: the effect renders the next frame right after
+   * the sync, so the plugins painting on top of it in beforeReportingState
+   * are not overwritten before their colors are sent.
+   */
+  ::LEDControl.syncLeds();
+  ::LEDControl.update();
+  frames_++;
+
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult LEDFrameScheduler::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("led.fps\nperf.scanHz\nperf.ledFps")))
+    return EventHandlerResult::OK;
+
+  if (strcmp_P(command, PSTR("led.fps")) == 0) {
+    if (::Focus.isEOL()) {
+      ::Focus.send(fps_);
+    } else {
+      uint8_t fps;
+      ::Focus.read(fps);
+      this->fps(fps);
+    }
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command, PSTR("perf.scanHz")) == 0) {
+    ::Focus.send(scan_rate_);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command, PSTR("perf.ledFps")) == 0) {
+    ::Focus.send(frame_rate_);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::LEDFrameScheduler LEDFrameScheduler;
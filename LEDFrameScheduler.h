@@ -0,0 +1,81 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::LEDFrameScheduler -- Fixed-rate LED frames
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * Decouples LED rendering from matrix scanning. Only one cycle per frame
+ * interval is a "frame cycle": plugins that paint LEDs should check
+ * isFrameCycle() and skip their work otherwise, and the scheduler itself
+ * updates the active LED effect and syncs the LEDs at the end of that cycle.
+ * Every other cycle only scans the matrix and sends HID reports.
+ */
+class LEDFrameScheduler: public Plugin {
+ public:
+  EventHandlerResult onSetup();
+  EventHandlerResult beforeEachCycle();
+  EventHandlerResult afterEachCycle();
+  EventHandlerResult onFocusEvent(const char *command);
+
+  static void fps(uint8_t fps);
+  static uint8_t fps() {
+    return fps_;
+  }
+  static void pause() {
+    paused_ = true;
+  }
+  static void resume() {
+    paused_ = false;
+  }
+  static bool isFrameCycle() {
+    return frame_cycle_;
+  }
+  static uint32_t scanRate() {
+    return scan_rate_;
+  }
+  static uint8_t frameRate() {
+    return frame_rate_;
+  }
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  static constexpr uint16_t measure_window_ = 1000;
+
+  static uint8_t fps_;
+  static uint16_t frame_interval_;
+  static uint16_t frame_start_;
+  static bool frame_cycle_;
+  static bool paused_;
+
+  static uint16_t measure_start_;
+  static uint32_t cycles_;
+  static uint8_t frames_;
+  static uint32_t scan_rate_;
+  static uint8_t frame_rate_;
+};
+
+}
+}
+
+extern kaleidoscope::plugin::LEDFrameScheduler LEDFrameScheduler;
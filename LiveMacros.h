@@ -20,33 +20,95 @@
 #include <Kaleidoscope.h>
 #include <Kaleidoscope-LEDControl.h>
 #include <Kaleidoscope-Ranges.h>
+#include <Kaleidoscope-FocusSerial.h>
+#include "LEDFrameScheduler.h"
+#include "StoragePool.h"
+#include "FocusBuffer.h"
+#include "ProfileBanks.h"
+#include "EEPROMScrubber.h"
 
 #define LM_RECORD Key(kaleidoscope::ranges::KALEIDOSCOPE_SAFE_START)
 #define LM_M(n) Key(kaleidoscope::ranges::KALEIDOSCOPE_SAFE_START + 1 + (n))
 
-#define MAX_EVENTS_IN_MACRO 14 //This number is the number of events (a key press is one event, a key release is one event). Total keys is this number/2
-#define TOTAL_MACROS 8 //This is the number of supported macros
-#define TOTAL_MACROS_IN_EEPROM 6 //Of the TOTAL_MACROS, how many of them will be saved in EEPROM
-
-#define LAST_EEPROM_MACRO_KEY (TOTAL_MACROS_IN_EEPROM - 1) //This is the last key with the macro saved in eeprom. Following keys will have the macro only in ram (volatile macro)
-#define TOTAL_PLUGIN_KEYS (TOTAL_MACROS + 1) //Total number of keys this plugins manages. (physical keys)
-#define KEY_START_INDEX TOTAL_MACROS //Index in the physical keys array of the start (record) key (must come after all the macro keys)
-
-static_assert (LAST_EEPROM_MACRO_KEY < TOTAL_MACROS, "Invalid number of last eeprom key");
-
 namespace Dygma{
 namespace plugin{
 
+using kaleidoscope::Runtime;
+using kaleidoscope::EventHandlerResult;
+using kaleidoscope::plugin::StoragePool;
+
 enum LM_Keys : uint16_t
 {
     LM_START_KEYS = kaleidoscope::ranges::KALEIDOSCOPE_SAFE_START,
-    LM_SLOT_0_KEY = kaleidoscope::ranges::KALEIDOSCOPE_SAFE_START + 1,
-    LM_END_KEYS = kaleidoscope::ranges::KALEIDOSCOPE_SAFE_START + 1 + TOTAL_MACROS
+    LM_SLOT_0_KEY = kaleidoscope::ranges::KALEIDOSCOPE_SAFE_START + 1
 };
 
+namespace live_macros{
+
+//Bit 7 of the flags byte of a recorded event tells if it is a key press or a key release.
+constexpr uint8_t key_pressed = B10000000;
+constexpr uint8_t key_pressed_mask = B01111111;
+
+int freeMemory();
+void playMacroKeyswitchEvent(Key key, uint8_t keyswitch_state);
+
+/**
+ * Helper to create LED blinks with different times. The time is specified as the template argument.
+ * e.g. blinkLed<300>
+ */
+template <uint T>
+cRGB& blinkLed(cRGB& colorOn, cRGB& colorOff)
+{
+    static bool blinkState = false;
+    static uint16_t blinkTime = 0;
+
+    if (Runtime.hasTimeExpired(blinkTime, T))
+    {
+        blinkTime = Runtime.millisAtCycleStart();
+        blinkState = ! blinkState;
+    }
+    if(blinkState)
+    {
+        return colorOn;
+    }
+    else
+    {
+        return colorOff;
+    }
+}
+
+}
+
+/**
+ * MaxEvents is the number of events in a macro (a key press is one event, a key release is one event). Total keys is this number/2
+ * TotalMacros is the number of supported macros, and the first MacrosInEEPROM of them are saved in EEPROM. The rest
+ * of them are only kept in RAM (volatile macros).
+ * The EEPROM macros are allocated from the StoragePool when they are saved, and only take the space they need.
+ * EEPROMBudget is the most pool space the plugin is allowed to take, over every profile. A recording that would go
+ * over it is not saved.
+ * CacheSlots is the number of EEPROM macros kept in a RAM cache, so pressing the same macro key again doesn't read
+ * the EEPROM. The least recently played macro is evicted first.
+ */
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget = 1024, uint8_t CacheSlots = 2>
 class LiveMacrosPlugin : public kaleidoscope::Plugin
 {
 public:
+    //Size in EEPROM of one macro: 1 byte for the number of events + 2 bytes per event
+    static constexpr uint16_t eeprom_macro_size = MaxEvents * 2 + 1;
+    //Worst case pool usage: all the EEPROM macros full
+    static constexpr uint16_t eeprom_size = eeprom_macro_size * MacrosInEEPROM;
+    //Size of the lv.map dump: one fixed size slot per EEPROM macro + 4bytes at the end for version & checksum (someday)
+    static constexpr uint16_t map_size = eeprom_size + 4;
+    //Worst case heap usage: every RAM macro saved plus the recording buffer
+    static constexpr uint16_t heap_size = eeprom_macro_size * (TotalMacros - MacrosInEEPROM + 1);
+
+    static_assert(MaxEvents > 0 && MaxEvents <= live_macros::key_pressed_mask, "Invalid number of events in a macro");
+    static_assert(eeprom_macro_size <= 0xff, "Macro buffer positions must fit in a byte");
+    static_assert(MacrosInEEPROM <= TotalMacros, "Invalid number of EEPROM macros");
+    static_assert(LM_SLOT_0_KEY + TotalMacros <= kaleidoscope::ranges::KALEIDOSCOPE_SAFE_START + 0xff, "Too many macro keys");
+    static_assert(eeprom_size <= EEPROMBudget, "The EEPROM macros don't fit in the EEPROM budget");
+    static_assert(MacrosInEEPROM <= kaleidoscope::plugin::ProfileBanks::items_per_profile, "Too many EEPROM macros for a profile");
+
     enum class state_t
     {
         IDLE,
@@ -57,25 +119,690 @@ public:
     };
 
     LiveMacrosPlugin();
-    kaleidoscope::EventHandlerResult onSetup();
-    kaleidoscope::EventHandlerResult onLayerChange();
-    kaleidoscope::EventHandlerResult beforeReportingState();
+    EventHandlerResult onLayerChange();
+    EventHandlerResult beforeReportingState();
+
+    EventHandlerResult onKeyswitchEvent(Key &mappedKey, KeyAddr key_addr, uint8_t keyState);
+    EventHandlerResult onFocusEvent(const char *command);
 
-    kaleidoscope::EventHandlerResult onKeyswitchEvent(Key &mappedKey, KeyAddr key_addr, uint8_t keyState);
-    kaleidoscope::EventHandlerResult onFocusEvent(const char *command);
+    //Moves the macros saved by firmware without the StoragePool, from their old fixed slice at base, into profile 0
+    void importLegacy(uint16_t base);
 private:
+    static constexpr uint8_t total_plugin_keys_ = TotalMacros + 1; //Total number of keys this plugins manages. (physical keys)
+    static constexpr uint8_t key_start_index_ = TotalMacros; //Index in the physical keys array of the start (record) key (must come after all the macro keys)
+
+    bool isFreeMacroPosition(uint8_t macroNumber) const;
+    void saveMacro(uint8_t macroNumber, uint8_t* buffer);
+    static bool isRamMacro(uint8_t macroNumber);
+    //The pool item of an EEPROM macro of the active profile
+    static uint8_t poolItem(uint8_t macroNumber)
+    {
+        return ::ProfileBanks.item(macroNumber);
+    }
+    static uint8_t mapByte(uint16_t index);
+    static void playMacro(const uint8_t* macro);
+    const uint8_t* cachedMacro(uint8_t macroNumber);
+    void invalidateCache(uint8_t macroNumber);
+    void invalidateCache();
+
+    //Cached by pool item, so the macros of other profiles never match
+    struct CachedMacro
+    {
+        uint8_t item;
+        uint32_t last_use; //32 bits, a 16 bit tick wraps after 65536 plays and evicts the newest
+        uint8_t data[eeprom_macro_size];
+    };
+
     state_t current_state_                  = state_t::IDLE;
-    KeyAddr keys_addrs_[TOTAL_PLUGIN_KEYS];
+    KeyAddr keys_addrs_[total_plugin_keys_];
     uint8_t* current_buff_                  = nullptr;
-    uint8_t* keys_[TOTAL_MACROS];
-    uint16_t eeprom_base_addr_              = 0;
+    uint8_t* keys_[TotalMacros];
     uint8_t current_buff_pos_               = 0;
     uint8_t macro_to_overwrite_             = 0;
     bool initialized_keys_                  = false;
 
+    CachedMacro cache_[CacheSlots];
+    uint32_t cache_tick_                    = 0;
+    uint8_t cache_generation_               = 0;
+    uint16_t cache_hits_                    = 0;
+    uint16_t cache_misses_                  = 0;
+    uint32_t last_start_latency_            = 0;
+    uint32_t total_start_latency_           = 0;
+    uint16_t plays_                         = 0;
 };
 
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+bool LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::isFreeMacroPosition(uint8_t macroNumber) const
+{
+    if (macroNumber < MacrosInEEPROM)
+    {
+        uint16_t eepos = ::StoragePool.find(StoragePool::LIVE_MACROS, poolItem(macroNumber));
+        if (eepos)
+        {
+            uint8_t macroSize = Runtime.storage().read(eepos);
+            if (macroSize > 0 && macroSize <= MaxEvents)
+            {
+                return false;
+            }
+        }
+    }
+    else 
+    {
+        if (keys_[macroNumber])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+void LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::saveMacro(uint8_t macroNumber, uint8_t* buffer)
+{
+    if (macroNumber < MacrosInEEPROM)
+    {
+        //EEprom macro
+        invalidateCache(macroNumber);
+        if (buffer[0] == 0)
+        {
+            //Empty recording, free the key
+            ::StoragePool.release(StoragePool::LIVE_MACROS, poolItem(macroNumber));
+        }
+        else
+        {
+            //Over the budget, or with the pool full, the recording is lost and the old macro kept
+            uint16_t length = buffer[0] * 2 + 1;
+            uint16_t old_length = 0;
+            ::StoragePool.find(StoragePool::LIVE_MACROS, poolItem(macroNumber), &old_length);
+            uint16_t eepos = 0;
+            if (::StoragePool.used(StoragePool::LIVE_MACROS) - old_length + length <= EEPROMBudget)
+            {
+                eepos = ::StoragePool.allocate(StoragePool::LIVE_MACROS, poolItem(macroNumber), length);
+            }
+            if (eepos)
+            {
+                for (uint8_t i = 0; i <= (buffer[0] * 2); ++i)
+                {
+                    Runtime.storage().write(eepos + i, buffer[i]);
+                }
+                ::EEPROMScrubber.reseal(eepos);
+            }
+        }
+        //TODO do the commit
+        free(buffer);
+    }
+    else
+    {
+        //RAM macro
+        //TODO if the key already have a buffer, copy the contents to the current key's buffer, to avoid memory fragmentation.
+        if (keys_[macroNumber])
+        {
+            free(keys_[macroNumber]);
+        }
+        keys_[macroNumber] = buffer;
+    }
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+bool LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::isRamMacro(uint8_t macroNumber)
+{
+    return (macroNumber >= MacrosInEEPROM);
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::LiveMacrosPlugin()
+{
+    memset(keys_, 0, sizeof(keys_));
+    invalidateCache();
+    for (uint8_t i = 0; i < total_plugin_keys_; ++i)
+    {
+        keys_addrs_[i] = KeyAddr::invalid_state;
+    }
+}
+
+/**
+ * The old slice held MacrosInEEPROM fixed slots of eeprom_macro_size bytes, in the same format the pool blocks use.
+ * An imported slot is marked free, so it is only imported once, and a macro already in the pool is never overwritten.
+ */
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+void LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::importLegacy(uint16_t base)
+{
+    bool imported = false;
+    for (uint8_t macroNumber = 0; macroNumber < MacrosInEEPROM; macroNumber++)
+    {
+        uint16_t slot = base + macroNumber * eeprom_macro_size;
+        uint8_t macroSize = Runtime.storage().read(slot);
+        if (macroSize == 0 || macroSize > MaxEvents)
+        {
+            continue;
+        }
+
+        //Profile 0 items are the macro numbers
+        if (!::StoragePool.find(StoragePool::LIVE_MACROS, macroNumber))
+        {
+            uint16_t eepos = ::StoragePool.allocate(StoragePool::LIVE_MACROS, macroNumber, macroSize * 2 + 1);
+            if (!eepos)
+            {
+                //Pool full, keep it for the next boot
+                continue;
+            }
+            for (uint8_t i = 0; i <= macroSize * 2; ++i)
+            {
+                Runtime.storage().update(eepos + i, Runtime.storage().read(slot + i));
+            }
+            ::EEPROMScrubber.reseal(eepos);
+        }
+        Runtime.storage().update(slot, 0xff);
+        ::EEPROMScrubber.reseal(slot);
+        imported = true;
+    }
+
+    if (imported)
+    {
+        invalidateCache();
+        Runtime.storage().commit();
+    }
+}
+
+/**
+ * The lv.map dump keeps the fixed slot layout, one slot of eeprom_macro_size bytes per EEPROM macro, with the
+ * unused bytes reading as erased EEPROM.
+ */
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+uint8_t LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::mapByte(uint16_t index)
+{
+    uint8_t macroNumber = index / eeprom_macro_size;
+    uint16_t offset = index % eeprom_macro_size;
+    if (macroNumber >= MacrosInEEPROM)
+    {
+        return 0xff;
+    }
+
+    uint16_t length;
+    uint16_t eepos = ::StoragePool.find(StoragePool::LIVE_MACROS, poolItem(macroNumber), &length);
+    if (!eepos || offset >= length)
+    {
+        return 0xff;
+    }
+    return Runtime.storage().read(eepos + offset);
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+void LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::playMacro(const uint8_t* macro)
+{
+    uint8_t pos = 1;
+    for (uint8_t i = 0; i < macro[0]; i++)
+    {
+        uint8_t flags = macro[pos++];
+        //Check our custom key mask for pressed or released key
+        Key key(macro[pos++], (flags & live_macros::key_pressed_mask));
+        if (flags & live_macros::key_pressed)
+        {
+            live_macros::playMacroKeyswitchEvent(key, IS_PRESSED);
+        }
+        else
+        {
+            live_macros::playMacroKeyswitchEvent(key, WAS_PRESSED);
+        }
+    }
+}
+
+/**
+ * Returns the EEPROM macro from the RAM cache, reading it into the least recently used slot if it's not there.
+ * Returns nullptr if the macro key is free.
+ */
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+const uint8_t* LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::cachedMacro(uint8_t macroNumber)
+{
+    //The pool directory was reloaded (e.g. after an EEPROM upload), nothing in the cache can be trusted
+    if (cache_generation_ != ::StoragePool.generation())
+    {
+        invalidateCache();
+        cache_generation_ = ::StoragePool.generation();
+    }
+
+    ++cache_tick_;
+    uint8_t victim = 0;
+    for (uint8_t i = 0; i < CacheSlots; ++i)
+    {
+        if (cache_[i].item == poolItem(macroNumber))
+        {
+            cache_[i].last_use = cache_tick_;
+            ++cache_hits_;
+            return cache_[i].data;
+        }
+        if (cache_[i].last_use < cache_[victim].last_use)
+        {
+            victim = i;
+        }
+    }
+
+    if (isFreeMacroPosition(macroNumber))
+    {
+        return nullptr;
+    }
+
+    ++cache_misses_;
+    uint16_t length;
+    uint16_t eepos = ::StoragePool.find(StoragePool::LIVE_MACROS, poolItem(macroNumber), &length);
+    for (uint16_t i = 0; i < length && i < eeprom_macro_size; ++i)
+    {
+        cache_[victim].data[i] = Runtime.storage().read(eepos + i);
+    }
+    cache_[victim].item = poolItem(macroNumber);
+    cache_[victim].last_use = cache_tick_;
+    return cache_[victim].data;
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+void LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::invalidateCache(uint8_t macroNumber)
+{
+    for (uint8_t i = 0; i < CacheSlots; ++i)
+    {
+        if (cache_[i].item == poolItem(macroNumber))
+        {
+            cache_[i].item = 0xff;
+            cache_[i].last_use = 0;
+        }
+    }
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+void LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::invalidateCache()
+{
+    for (uint8_t i = 0; i < CacheSlots; ++i)
+    {
+        cache_[i].item = 0xff;
+        cache_[i].last_use = 0;
+    }
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+EventHandlerResult LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::onLayerChange()
+{
+    keys_addrs_[key_start_index_] = UnknownKeyswitchLocation;
+
+    for (auto key_addr: KeyAddr::all()) {
+        Key k = Layer.lookupOnActiveLayer(key_addr);
+        if (k.getRaw() == LM_START_KEYS) {
+            keys_addrs_[key_start_index_] = key_addr;
+            //If this is not the first time we found the start key, don't keep looking for the rest of the keys
+            if (initialized_keys_)
+                break;
+            initialized_keys_ = true;
+        }
+        else if (k.getRaw() >= LM_SLOT_0_KEY && k.getRaw() < LM_SLOT_0_KEY + TotalMacros)
+        {
+            uint8_t macroNumber = k.getRaw() - LM_SLOT_0_KEY;
+            keys_addrs_[macroNumber] = key_addr;
+        }
+    }
+
+    return EventHandlerResult::OK;
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+EventHandlerResult LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::beforeReportingState()
+{
+    //LEDs are only painted on frame cycles, the rest of the cycles are left for scanning.
+    if (!::LEDFrameScheduler.isFrameCycle())
+    {
+        return EventHandlerResult::OK;
+    }
+
+    switch(current_state_)
+    {
+        case state_t::IDLE:
+            if (keys_addrs_[key_start_index_].isValid())
+            {
+                cRGB color = breath_compute(170);
+                ::LEDControl.setCrgbAt(keys_addrs_[key_start_index_], color);
+
+                for (uint8_t i = 0; i < TotalMacros; ++i)
+                {
+                    cRGB color = {0, 0, 0};
+                    if (keys_addrs_[i].isValid())
+                    {
+                        if (!isFreeMacroPosition(i))
+                        {
+                            color.r = 149;
+                            color.g = 255;
+                            color.b = 0;
+                        }
+                        ::LEDControl.setCrgbAt(keys_addrs_[i], color);
+                    }
+                }
+            }
+            else
+            {
+                for (uint8_t i = 0; i < total_plugin_keys_; ++i)
+                {
+                    if (keys_addrs_[i].isValid())
+                    {
+                        ::LEDControl.refreshAt(keys_addrs_[i]);
+                    }
+                }
+            }
+        break;
+        case state_t::RECORDING:
+        case state_t::MAX_KEYS_REACHED:
+        case state_t::ARE_YOU_SURE_TO_OVERWRITE:
+            if (keys_addrs_[key_start_index_].isValid())
+            {
+                //Record key red blinking
+                cRGB color = {255, 0, 0};
+                cRGB off = {0, 0, 0};
+                ::LEDControl.setCrgbAt(keys_addrs_[key_start_index_], live_macros::blinkLed<100>(color, off));
+
+                //Macro keys coloring.
+                for (uint8_t i = 0; i < TotalMacros; ++i)
+                {
+                    color = {149, 255, 0};
+                    if (keys_addrs_[i].isValid())
+                    {
+                        if (!isFreeMacroPosition(i))
+                        {
+                            color.r = 255;
+                            color.g = 0;
+                            color.b = 0;
+                        }
+                        
+                        if (current_state_ == state_t::ARE_YOU_SURE_TO_OVERWRITE && macro_to_overwrite_ == i)
+                        {
+                            cRGB yellow = {209, 220, 27};
+                            ::LEDControl.setCrgbAt(keys_addrs_[i], live_macros::blinkLed<400>(yellow, color));
+                        }
+                        else
+                        {
+                            if (isRamMacro(i))
+                            {
+                                cRGB blue = {0, 0, 255};
+                                ::LEDControl.setCrgbAt(keys_addrs_[i], live_macros::blinkLed<400>(blue, color));
+                            }
+                            else
+                            {
+                                ::LEDControl.setCrgbAt(keys_addrs_[i], color);
+                            }
+                        }
+                    }
+                }
+            }
+            else
+            {
+                for (uint8_t i = 0; i < total_plugin_keys_; ++i)
+                {
+                    if (keys_addrs_[i].isValid())
+                    {
+                        ::LEDControl.refreshAt(keys_addrs_[i]);
+                    }
+                }
+            }
+        break;
+    }
+
+    return EventHandlerResult::OK;
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+EventHandlerResult LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::onKeyswitchEvent(Key &mappedKey, KeyAddr key_addr, uint8_t keyState)
+{
+    switch(current_state_)
+    {
+        case state_t::IDLE:
+            if (mappedKey.getRaw() == LM_START_KEYS && keyToggledOn(keyState))
+            {
+                //Change status to RECORDING
+                current_state_ = state_t::RECORDING;
+                if (current_buff_)
+                {
+                    //should never happen
+                    free(current_buff_);
+                }
+                //Allocate memory for the macro keys buffer. 
+                current_buff_ = (uint8_t*)malloc(eeprom_macro_size);
+                //Set first element of the buffer to 0, as this is the number of events in the macro.
+                *current_buff_ = 0;
+                current_buff_pos_ = 1;
+                return EventHandlerResult::EVENT_CONSUMED;
+            } 
+            else if (mappedKey.getRaw() >= LM_SLOT_0_KEY && mappedKey.getRaw() < LM_SLOT_0_KEY + TotalMacros && keyToggledOn(keyState))
+            {
+                //Play a saved macro
+                uint8_t macroNumber = mappedKey.getRaw() - LM_SLOT_0_KEY;
+                uint32_t start = micros();
+                const uint8_t* macro = isRamMacro(macroNumber) ? keys_[macroNumber] : cachedMacro(macroNumber);
+                if (macro)
+                {
+                    last_start_latency_ = micros() - start;
+                    total_start_latency_ += last_start_latency_;
+                    ++plays_;
+                    playMacro(macro);
+                }
+                return EventHandlerResult::EVENT_CONSUMED;
+            }
+            else
+            {
+                return EventHandlerResult::OK;
+            }
+            
+        break;
+        case state_t::RECORDING:
+            if (mappedKey.getRaw() == LM_START_KEYS && keyToggledOn(keyState))
+            {
+                //DISCARD CURRENT RECORDING
+                current_state_ = state_t::IDLE;
+
+                if (current_buff_)
+                {
+                    free(current_buff_);
+                }
+                current_buff_ = nullptr;
+                return EventHandlerResult::EVENT_CONSUMED;
+            } 
+            else if (mappedKey.getRaw() >= LM_SLOT_0_KEY && mappedKey.getRaw() < LM_SLOT_0_KEY + TotalMacros && keyToggledOn(keyState))
+            {
+                //Stop the recording and save the recording
+                uint8_t macroNumber = mappedKey.getRaw() - LM_SLOT_0_KEY;
+                //TODO check there is almost one event recorded. 
+
+                if (!isFreeMacroPosition(macroNumber))
+                {
+                    //Macro already saved in key
+                    current_state_ = state_t::ARE_YOU_SURE_TO_OVERWRITE;
+                    macro_to_overwrite_ = macroNumber;
+                    return EventHandlerResult::EVENT_CONSUMED;
+                }
+
+                saveMacro(macroNumber, current_buff_);
+                current_buff_ = nullptr;
+
+                current_state_ = state_t::IDLE;
+                return EventHandlerResult::EVENT_CONSUMED;
+            }
+            else if (keyToggledOn(keyState) || keyToggledOff(keyState)) 
+            {
+                //We only listen for key pressed and key released events.
+                //If standard key, save the key but let it go to other plugins.
+                //A standar key is a non synthetic non reserved and non injected one.
+                if (((mappedKey.getFlags() & (SYNTHETIC | RESERVED)) == 0) && ((keyState & INJECTED) == 0))
+                {
+                    ++(*current_buff_);
+                    //Standard key
+                    if (keyToggledOn(keyState))
+                    {
+                        //As we know the key is not reserved, use the bit 7 in flags to store if this is a key press or key release.
+                        current_buff_[current_buff_pos_++] = mappedKey.getFlags() | live_macros::key_pressed;
+                        current_buff_[current_buff_pos_++] = mappedKey.getKeyCode();
+                    }
+                    else
+                    {
+                        current_buff_[current_buff_pos_++] = mappedKey.getFlags();
+                        current_buff_[current_buff_pos_++] = mappedKey.getKeyCode();
+                    }
+                    //TODO this works only for one slot key, refactor.
+                    if ((*current_buff_) == MaxEvents)
+                    {
+                        current_state_ = state_t::MAX_KEYS_REACHED;
+                    }
+                }
+            }
+            
+            return EventHandlerResult::OK;
+        break;
+        case state_t::MAX_KEYS_REACHED:
+            //TODO Refactor this to avoid duplicated code.
+            if (mappedKey.getRaw() == LM_START_KEYS && keyToggledOn(keyState))
+            {
+                //DISCARD CURRENT RECORDING
+                
+                current_state_ = state_t::IDLE;
+
+                if (current_buff_)
+                {
+                    free(current_buff_);
+                }
+                current_buff_ = nullptr;
+                return EventHandlerResult::EVENT_CONSUMED;
+            } 
+            else if (mappedKey.getRaw() >= LM_SLOT_0_KEY && mappedKey.getRaw() < LM_SLOT_0_KEY + TotalMacros && keyToggledOn(keyState))
+            {
+                //Stop the recording and save the recording
+                uint8_t macroNumber = mappedKey.getRaw() - LM_SLOT_0_KEY;
+                //TODO check there is almost one event recorded. 
+
+                if (!isFreeMacroPosition(macroNumber))
+                {
+                    //Macro already saved in key
+                    current_state_ = state_t::ARE_YOU_SURE_TO_OVERWRITE;
+                    macro_to_overwrite_ = macroNumber;
+                    return EventHandlerResult::EVENT_CONSUMED;
+                }
+
+                saveMacro(macroNumber, current_buff_);
+                current_buff_ = nullptr;
+                
+                current_state_ = state_t::IDLE;
+                return EventHandlerResult::EVENT_CONSUMED;
+            }
+            return EventHandlerResult::OK;
+        break;
+        case state_t::ARE_YOU_SURE_TO_OVERWRITE:
+            if (mappedKey.getRaw() == LM_START_KEYS && keyToggledOn(keyState))
+            {
+                //DISCARD CURRENT RECORDING
+                
+                current_state_ = state_t::IDLE;
+
+                if (current_buff_)
+                {
+                    free(current_buff_);
+                }
+                current_buff_ = nullptr;
+                return EventHandlerResult::EVENT_CONSUMED;
+            } 
+            else if (mappedKey.getRaw() >= LM_SLOT_0_KEY && mappedKey.getRaw() < LM_SLOT_0_KEY + TotalMacros && keyToggledOn(keyState))
+            {
+                //Stop the recording and save the recording
+                uint8_t macroNumber = mappedKey.getRaw() - LM_SLOT_0_KEY;
+
+                if (!isFreeMacroPosition(macroNumber) && macro_to_overwrite_ != macroNumber)
+                {
+                    //The user has selected another key with saved macro
+                    macro_to_overwrite_ = macroNumber;
+                    return EventHandlerResult::EVENT_CONSUMED;
+                }
+
+                saveMacro(macroNumber, current_buff_);
+                current_buff_ = nullptr;
+                
+                current_state_ = state_t::IDLE;
+                return EventHandlerResult::EVENT_CONSUMED;
+            }
+            else
+            {
+                //Block the keyboard until discarded, overwritten or saved.
+                return EventHandlerResult::EVENT_CONSUMED;
+            }
+            
+        break;
+    }
+}
+
+template <uint8_t MaxEvents, uint8_t TotalMacros, uint8_t MacrosInEEPROM, uint16_t EEPROMBudget, uint8_t CacheSlots>
+EventHandlerResult LiveMacrosPlugin<MaxEvents, TotalMacros, MacrosInEEPROM, EEPROMBudget, CacheSlots>::onFocusEvent(const char *command)
+{
+    if (::Focus.handleHelp(command, PSTR("lv.map\nlv.mapraw\nlv.clean\nlv.commit\nlv.freeram\nlv.footprint\nlv.cache")))
+    return EventHandlerResult::OK;
+
+    if (strncmp_P(command, PSTR("lv."), 3) != 0)
+        return EventHandlerResult::OK;
+
+    if (strcmp_P(command + 3, PSTR("map")) == 0) 
+    {
+        if (::Focus.isEOL()) {
+            for (uint16_t i = 0; i < map_size; i++) {
+                uint8_t b;
+                b = mapByte(i);
+                ::FocusBuffer.send(b);
+            }
+            ::FocusBuffer.flush();
+        }
+    }
+
+    if (strcmp_P(command + 3, PSTR("mapraw")) == 0) 
+    {
+        if (::Focus.isEOL()) {
+            for (uint16_t i = 0; i < map_size; i++) {
+                uint8_t b;
+                b = mapByte(i);
+                ::FocusBuffer.write(b);
+            }
+            ::FocusBuffer.flush();
+        }
+    }
+
+    if (strcmp_P(command + 3, PSTR("clean")) == 0) 
+    {
+        //Only the macros of the active profile
+        for (uint8_t i = 0; i < MacrosInEEPROM; i++)
+        {
+            ::StoragePool.release(StoragePool::LIVE_MACROS, poolItem(i));
+        }
+        invalidateCache();
+    }
+
+    if (strcmp_P(command + 3, PSTR("commit")) == 0) 
+    {
+        Runtime.storage().commit();
+    }
+
+    if (strcmp_P(command + 3, PSTR("freeram")) == 0) 
+    {
+        ::Focus.send(live_macros::freeMemory());
+    }
+
+    if (strcmp_P(command + 3, PSTR("footprint")) == 0) 
+    {
+        ::Focus.send(static_cast<uint16_t>(sizeof(*this)));
+        ::Focus.send(heap_size);
+        ::Focus.send(eeprom_size);
+    }
+
+    if (strcmp_P(command + 3, PSTR("cache")) == 0) 
+    {
+        //Cache hits, cache misses, last and average playback start latency in microseconds
+        ::Focus.send(cache_hits_, cache_misses_, last_start_latency_);
+        ::Focus.send(plays_ ? total_start_latency_ / plays_ : 0);
+    }
+
+    return EventHandlerResult::EVENT_CONSUMED;
+}
+
+//Capacity of the LiveMacros of this firmware: 14 events per macro, 8 macros, 6 of them saved in EEPROM.
+typedef LiveMacrosPlugin<14, 8, 6> RaiseLiveMacros;
+
 }
 }
 
-extern Dygma::plugin::LiveMacrosPlugin LiveMacros;
\ No newline at end of file
+extern Dygma::plugin::RaiseLiveMacros LiveMacros;
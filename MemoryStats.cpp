@@ -0,0 +1,122 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::MemoryStats -- Stack and heap high-water marks
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemoryStats.h"
+
+#ifdef ARDUINO_SAMD_RAISE
+
+#include <malloc.h>
+#include <Kaleidoscope-FocusSerial.h>
+
+// Symbols provided by the linker script
+extern "C" char __data_start__;
+extern "C" char __bss_end__;
+extern "C" char __StackTop;
+extern "C" char end;
+
+extern "C" char* sbrk(int incr);
+
+static uint32_t allocator_calls_;
+
+/*
+ * newlib takes this lock once for every malloc, realloc and free, so overriding
+ * it is the cheapest way to count allocator calls without wrapping malloc.
+ */
+extern "C" void __malloc_lock(struct _reent *) {
+  allocator_calls_++;
+}
+
+extern "C" void __malloc_unlock(struct _reent *) {
+}
+
+namespace kaleidoscope {
+namespace plugin {
+
+uint8_t *MemoryStats::paint_start_;
+MemoryStats::TrackedPlugin MemoryStats::plugins_[];
+uint8_t MemoryStats::plugin_count_;
+
+void MemoryStats::track(const char *name, uint16_t static_ram) {
+  if (plugin_count_ < max_plugins_)
+    plugins_[plugin_count_++] = {name, static_ram};
+}
+
+__attribute__((noinline)) EventHandlerResult MemoryStats::onSetup() {
+  uint8_t top;
+
+  paint_start_ = reinterpret_cast<uint8_t *>(sbrk(0));
+  for (uint8_t *p = paint_start_; p < &top - paint_margin_; p++)
+    *p = paint_;
+
+  return EventHandlerResult::OK;
+}
+
+uint32_t MemoryStats::staticRam() {
+  return &__bss_end__ - &__data_start__;
+}
+
+uint32_t MemoryStats::stackPeak() {
+  uint8_t *p = paint_start_;
+
+  // Skip whatever the heap took since boot, then the untouched paint
+  uint8_t *heap_top = reinterpret_cast<uint8_t *>(sbrk(0));
+  if (p < heap_top)
+    p = heap_top;
+  while (p < reinterpret_cast<uint8_t *>(&__StackTop) && *p == paint_)
+    p++;
+
+  return reinterpret_cast<uint8_t *>(&__StackTop) - p;
+}
+
+uint32_t MemoryStats::heapPeak() {
+  // newlib never gives memory back to sbrk, so the break is the high-water mark
+  return reinterpret_cast<char *>(sbrk(0)) - &end;
+}
+
+uint32_t MemoryStats::heapInUse() {
+  return mallinfo().uordblks;
+}
+
+uint32_t MemoryStats::allocatorCalls() {
+  return allocator_calls_;
+}
+
+EventHandlerResult MemoryStats::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("mem.stats")))
+    return EventHandlerResult::OK;
+
+  if (strcmp_P(command, PSTR("mem.stats")) != 0)
+    return EventHandlerResult::OK;
+
+  // static RAM, stack peak, heap peak, heap in use, allocator calls, free RAM at the deepest stack point
+  uint32_t stack_peak = stackPeak();
+  ::Focus.send(staticRam(), stack_peak, heapPeak(), heapInUse(), allocatorCalls());
+  ::Focus.send(static_cast<uint32_t>(&__StackTop - reinterpret_cast<char *>(sbrk(0))) - stack_peak);
+
+  // Then, for every tracked plugin, its name and static RAM
+  for (uint8_t i = 0; i < plugin_count_; i++)
+    ::Focus.send(reinterpret_cast<const __FlashStringHelper *>(plugins_[i].name), plugins_[i].static_ram);
+
+  return EventHandlerResult::EVENT_CONSUMED;
+}
+
+}
+}
+
+#endif
+
+kaleidoscope::plugin::MemoryStats MemoryStats;
@@ -0,0 +1,78 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::MemoryStats -- Stack and heap high-water marks
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+#ifdef ARDUINO_SAMD_RAISE
+
+/*
+ * Paints the free RAM between the heap and the stack at boot, so the deepest
+ * point the stack ever reached can be found later. Together with the heap
+ * high-water mark and the number of allocator calls, this tells how much room
+ * is left before enabling more plugins.
+ *
+ * mem.stats sends those, then the name and static RAM of every plugin the
+ * sketch tracks.
+ */
+class MemoryStats: public Plugin {
+ public:
+  EventHandlerResult onSetup();
+  EventHandlerResult onFocusEvent(const char *command);
+
+  // name is a PSTR
+  static void track(const char *name, uint16_t static_ram);
+
+  static uint32_t staticRam();
+  static uint32_t stackPeak();
+  static uint32_t heapPeak();
+  static uint32_t heapInUse();
+  static uint32_t allocatorCalls();
+
+ private:
+  static constexpr uint8_t paint_ = 0xa5;
+  static constexpr uint8_t paint_margin_ = 64;
+  static constexpr uint8_t max_plugins_ = 16;
+
+  struct TrackedPlugin {
+    const char *name;
+    uint16_t static_ram;
+  };
+
+  static uint8_t *paint_start_;
+  static TrackedPlugin plugins_[max_plugins_];
+  static uint8_t plugin_count_;
+};
+
+#else
+
+// The stack and heap layout is the Raise's, elsewhere there is nothing to measure
+class MemoryStats: public Plugin {
+ public:
+  static void track(const char *, uint16_t) {}
+};
+
+#endif
+
+}
+}
+
+extern kaleidoscope::plugin::MemoryStats MemoryStats;
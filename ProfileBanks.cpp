@@ -0,0 +1,137 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::ProfileBanks -- Switch between complete setups at once
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ProfileBanks.h"
+#include "EEPROMScrubber.h"
+#include "StoragePool.h"
+
+#include <Kaleidoscope-EEPROM-Settings.h>
+#include <Kaleidoscope-FocusSerial.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+uint16_t ProfileBanks::settings_base_;
+uint8_t ProfileBanks::layers_per_profile_ = 1;
+uint8_t ProfileBanks::count_ = 1;
+uint8_t ProfileBanks::active_;
+uint16_t ProfileBanks::switch_time_;
+uint16_t ProfileBanks::save_time_;
+
+uint16_t ProfileBanks::staticRam() {
+  return sizeof(settings_base_) + sizeof(layers_per_profile_) +
+         sizeof(count_) + sizeof(active_) + sizeof(switch_time_) +
+         sizeof(save_time_);
+}
+
+void ProfileBanks::setup(uint8_t layers, uint8_t layers_per_profile) {
+  settings_base_ = ::EEPROMSettings.requestSlice(sizeof(active_));
+  layers_per_profile_ = layers_per_profile;
+  count_ = layers / layers_per_profile;
+
+  // Profile 0, or an erased slice, keeps the default layer EEPROMSettings picked
+  uint8_t saved = Runtime.storage().read(settings_base_);
+  if (saved != 0 && saved < count_)
+    apply(saved);
+}
+
+void ProfileBanks::apply(uint8_t profile) {
+  active_ = profile;
+  Layer.move(baseLayer());
+}
+
+void ProfileBanks::activate(uint8_t profile) {
+  if (profile >= count_ || profile == active_)
+    return;
+
+  uint32_t start = micros();
+  apply(profile);
+  switch_time_ = micros() - start;
+
+  start = micros();
+  Runtime.storage().update(settings_base_, active_);
+  Runtime.storage().commit();
+  ::EEPROMScrubber.reseal(settings_base_);
+  save_time_ = micros() - start;
+}
+
+EventHandlerResult ProfileBanks::onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state) {
+  if (active_ == 0 || mapped_key.getFlags() != (SYNTHETIC | SWITCH_TO_KEYMAP))
+    return EventHandlerResult::OK;
+
+  // LockLayer(n) is n, ShiftToLayer(n) and MoveToLayer(n) are offset from it
+  uint8_t code = mapped_key.getKeyCode();
+  uint8_t offset = code >= LAYER_MOVE_OFFSET ? LAYER_MOVE_OFFSET :
+                   code >= LAYER_SHIFT_OFFSET ? LAYER_SHIFT_OFFSET : 0;
+
+  // Anything past the profile's layers, like KEYMAP_NEXT, is left alone
+  if (code - offset < layers_per_profile_)
+    mapped_key.setKeyCode(code + baseLayer());
+
+  return EventHandlerResult::OK;
+}
+
+EventHandlerResult ProfileBanks::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("profile.active\nprofile.size\nprofile.latency")))
+    return EventHandlerResult::OK;
+
+  if (strncmp_P(command, PSTR("profile."), 8) != 0)
+    return EventHandlerResult::OK;
+
+  if (strcmp_P(command + 8, PSTR("active")) == 0) {
+    if (::Focus.isEOL()) {
+      ::Focus.send(active_);
+    } else {
+      uint8_t profile;
+      ::Focus.read(profile);
+      activate(profile);
+    }
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 8, PSTR("size")) == 0) {
+    // For each profile: the EEPROM bytes of its keymap layers and colormaps,
+    // which are fixed, and of its saved LiveMacros, which grow with use
+    // ColormapEffect keeps two LEDs per byte, and there are more LEDs than keys
+    uint16_t keymaps = layers_per_profile_ * KeyAddr::upper_limit * sizeof(Key);
+    uint16_t colormaps = layers_per_profile_ * Runtime.device().led_count / 2;
+    uint16_t fixed = keymaps + colormaps;
+    for (uint8_t profile = 0; profile < count_; profile++) {
+      uint16_t macros = 0;
+      for (uint8_t i = 0; i < items_per_profile; i++) {
+        uint16_t length;
+        if (::StoragePool.find(StoragePool::LIVE_MACROS, profile * items_per_profile + i, &length))
+          macros += length;
+      }
+      ::Focus.send(fixed, macros);
+    }
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 8, PSTR("latency")) == 0) {
+    // Microseconds the last switch took, and saving the choice to EEPROM after it
+    ::Focus.send(switch_time_, save_time_);
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::ProfileBanks ProfileBanks;
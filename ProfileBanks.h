@@ -0,0 +1,86 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::ProfileBanks -- Switch between complete setups at once
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * Splits the EEPROM keymap layers into profiles of layers_per_profile layers
+ * each. Profile 1 of 5 layer profiles is layers 5 to 9, and so on. The
+ * colormaps follow, since ColormapEffect keeps one per layer, and so do the
+ * LiveMacros, which keep each profile's macros in their own StoragePool items.
+ * Nothing is copied on a switch: the active profile only picks the base layer
+ * and the pool items.
+ *
+ * Layer keys on a profile's layers are relative to the profile: MoveToLayer(1)
+ * on profile 1 moves to its second layer, layer 6. Profile 0 behaves exactly
+ * as before. The LED palette is shared by all profiles.
+ *
+ * Put it before the plugins that handle layer keys in KALEIDOSCOPE_INIT_PLUGINS.
+ */
+class ProfileBanks: public Plugin {
+ public:
+  // StoragePool items each profile gets, per owner
+  static constexpr uint8_t items_per_profile = 8;
+
+  EventHandlerResult onKeyswitchEvent(Key &mapped_key, KeyAddr key_addr, uint8_t key_state);
+  EventHandlerResult onFocusEvent(const char *command);
+
+  // Reserves the EEPROM slice and switches to the saved profile
+  static void setup(uint8_t layers, uint8_t layers_per_profile);
+
+  static uint8_t count() {
+    return count_;
+  }
+  static uint8_t active() {
+    return active_;
+  }
+  static uint8_t baseLayer() {
+    return active_ * layers_per_profile_;
+  }
+  // The StoragePool item an owner uses for its index-th item in the active profile
+  static uint8_t item(uint8_t index) {
+    return active_ * items_per_profile + index;
+  }
+
+  static void activate(uint8_t profile);
+  static void next() {
+    activate((active_ + 1) % count_);
+  }
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  static uint16_t settings_base_;
+  static uint8_t layers_per_profile_;
+  static uint8_t count_;
+  static uint8_t active_;
+  static uint16_t switch_time_;
+  static uint16_t save_time_;
+
+  static void apply(uint8_t profile);
+};
+
+}
+}
+
+extern kaleidoscope::plugin::ProfileBanks ProfileBanks;
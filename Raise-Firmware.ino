@@ -35,33 +35,62 @@
 #include "Kaleidoscope-TapDance.h"
 #include "Kaleidoscope-DynamicTapDance.h"
 #include "Kaleidoscope-DynamicMacros.h"
-#include "Kaleidoscope-MagicCombo.h"
 #include "Kaleidoscope-USB-Quirks.h"
 #include "Kaleidoscope-LayerFocus.h"
 #include "RaiseIdleLEDs.h"
+#include "MemoryStats.h"
+#include "BootProfiler.h"
+#ifdef ARDUINO_SAMD_RAISE
 #include "kaleidoscope/device/dygma/raise/Focus.h"
 #include "kaleidoscope/device/dygma/raise/SideFlash.h"
+#endif
 
 #include "Kaleidoscope-OneShot.h"
 #include "Kaleidoscope-Qukeys.h"
 #include "Kaleidoscope-Escape-OneShot.h"
 
+#include "StoragePool.h"
+#include "FocusBuffer.h"
+#include "KeyboardProtocol.h"
+#include "KeyUsage.h"
+#include "ProfileBanks.h"
+#include "EEPROMScrubber.h"
+#include "ComboMasks.h"
 #include "LiveMacros.h"
 
 #include "LED-CapsLockLight.h"
+#include "LEDFrameScheduler.h"
 #include "EEPROMPadding.h"
 
 #include "EEPROMUpgrade.h"
+#include "TraceReplay.h"
 
+#ifdef ARDUINO_SAMD_RAISE
 #include "attiny_firmware.h"
+#endif
 
 enum { QWERTY, NUMPAD, _LAYER_MAX }; // layers
 
+static void toggleKeyboardProtocol(uint8_t combo_index) {
+  KeyboardProtocol.toggle();
+}
+
+static void nextProfile(uint8_t combo_index) {
+  ProfileBanks.next();
+}
+
 /* This comment temporarily turns off astyle's indent enforcement so we can make
  * the keymaps actually resemble the physical key layout better
  */
 // *INDENT-OFF*
 
+#ifdef KALEIDOSCOPE_VIRTUAL_BUILD
+
+// The replay benchmark runs on a virtual Model 01, with a keymap of its own
+#include "bench/VirtualKeymap.h"
+
+#else
+
 KEYMAPS(
 [QWERTY] = KEYMAP_STACKED
 (
@@ -98,69 +127,64 @@ KEYMAPS(
  )
 );
 
-
 /* Re-enable astyle's indent enforcement */
 // *INDENT-ON*
 
+USE_COMBO_MASKS(
+    // Left Ctrl + Left Shift + Left Alt + 6
+    COMBO(toggleKeyboardProtocol, R4C0, R3C0, R4C2, R0C6),
+    // Left Ctrl + Left Shift + Left Alt + 5
+    COMBO(nextProfile, R4C0, R3C0, R4C2, R0C5)
+);
+
+#endif
+
+#ifdef ARDUINO_SAMD_RAISE
 kaleidoscope::device::dygma::raise::SideFlash<ATTinyFirmware> SideFlash;
 
+// Plugins for the Raise hardware, the virtual builds go without them
+#define RAISE_DEVICE_PLUGINS RaiseFocus, SideFlash,
+#else
+#define RAISE_DEVICE_PLUGINS
+#endif
+
 // void tapDanceAction(uint8_t tap_dance_index, KeyAddr key_addr,
 //                     uint8_t tap_count,
 //                     kaleidoscope::plugin::TapDance::ActionType tap_dance_action) {
 //   DynamicTapDance.dance(tap_dance_index, key_addr, tap_count, tap_dance_action);
 // }
 
-// enum {
-//   COMBO_TOGGLE_NKRO_MODE
-// };
-
-// static uint32_t protocol_toggle_start = 0;
-
-// static void toggleKeyboardProtocol(uint8_t combo_index) {
-//   USBQuirks.toggleKeyboardProtocol();
-//   protocol_toggle_start = Kaleidoscope.millisAtCycleStart();
-// }
-
-// static void protocolBreathe() {
-//   if (Kaleidoscope.hasTimeExpired(protocol_toggle_start, uint16_t(10000))) {
-//     protocol_toggle_start = 0;
-//   }
-//   if (protocol_toggle_start == 0)
-//     return;
-
-//   uint8_t hue = 120;
-//   if (Kaleidoscope.hid().keyboard().getProtocol() == HID_BOOT_PROTOCOL) {
-//     hue = 0;
-//   }
-
-//   cRGB color = breath_compute(hue);
-//   ::LEDControl.setCrgbAt(KeyAddr(4, 0), color);
-//   ::LEDControl.setCrgbAt(KeyAddr(3, 0), color);
-//   ::LEDControl.setCrgbAt(KeyAddr(4, 2), color);
-//   ::LEDControl.setCrgbAt(KeyAddr(0, 6), color);
-//   ::LEDControl.syncLeds();
-// }
-
-// USE_MAGIC_COMBOS(
-//     {
-//       .action = toggleKeyboardProtocol,
-//       // Left Ctrl + Left Shift + Left Alt + 6
-//       .keys = { R4C0, R3C0, R4C2, R0C6 }
-//     }
-// );
-
 // kaleidoscope::plugin::EEPROMPadding JointPadding(8);
 
+// Where LiveMacros kept its macros before the StoragePool, the slices after it stay where they were
+kaleidoscope::plugin::EEPROMPadding LegacyLiveMacros(Dygma::plugin::RaiseLiveMacros::map_size);
+
 KALEIDOSCOPE_INIT_PLUGINS(
+  // First, to time whole cycles and put held keys straight back in the report
+  KeyboardProtocol,
+  // Early, to count presses before other plugins consume them
+  KeyUsage,
+  // Before anything that handles layer keys
+  ProfileBanks,
+  // Before the Focus commands that write to the EEPROM
+  EEPROMScrubber,
   // USBQuirks,
-  // MagicCombo,
+  ComboMasks,
   // RaiseIdleLEDs,
+  BootProfiler,
+  MemoryStats,
+  // Before the plugins that handle keymap uploads, to notice them
+  LEDCapsLockLight,
   EEPROMSettings,
   EEPROMKeymap,
   FocusSettingsCommand,
+  // Must come before FocusEEPROMCommand, to notice EEPROM uploads
+  StoragePool,
+  // Must come before FocusEEPROMCommand, it serves eeprom.contents reads
+  FocusBuffer,
   FocusEEPROMCommand,
-  LEDCapsLockLight,
   LEDControl,
+  LEDFrameScheduler,
   PersistentLEDMode,
   FocusLEDCommand,
   LEDPaletteTheme,
@@ -168,26 +192,59 @@ KALEIDOSCOPE_INIT_PLUGINS(
   ColormapEffect,
   LEDRainbowWaveEffect, LEDRainbowEffect, StalkerEffect,
   PersistentIdleLEDs,
-  RaiseFocus,
   // TapDance,
   // DynamicTapDance,
   // DynamicMacros,
-  SideFlash,
+  RAISE_DEVICE_PLUGINS
   Focus,
   // MouseKeys,
   // OneShot,
   // EscapeOneShot,
   // Qukeys,
   LayerFocus,
+  // Must stay at the end, where LiveMacros requested its slice
+  LegacyLiveMacros,
   LiveMacros
   // EEPROMUpgrade
 );
 
+// Setup work that can wait until the host has enumerated the keyboard
+static void deferredSetup() {
+  // Read the pool directory now rather than on the first macro key press
+  StoragePool.load();
+  LiveMacros.importLegacy(LegacyLiveMacros.base());
+
+  // EEPROMUpgrade.upgrade();
+
+  // Start sending the LEDs to the halves
+  LEDFrameScheduler.resume();
+}
+
+// The defaults EEPROMUpgrade also falls back to, for a damaged LED mode or idle timeout
+static void resetLEDSettings(uint16_t start, uint16_t end) {
+  EEPROMScrubber.erase(start, end);
+  PersistentIdleLEDs.setIdleTimeoutSeconds(600);
+  LEDControl.set_mode(0);
+}
+
 void setup() {
+  BootProfiler.mark(BootProfiler.SETUP_START);
   Kaleidoscope.serialPort().begin(9600);
+
+  // Keep the LED traffic to the halves out of the way until the host enumerated us
+  LEDFrameScheduler.pause();
+  uint16_t plugin_slices = EEPROMSettings.used();
   Kaleidoscope.setup();
+  BootProfiler.mark(BootProfiler.KALEIDOSCOPE_SETUP);
+
+  /*
+   * The EEPROM slices below, and the ones the plugins request in onSetup, are
+   * laid out in the order they are requested. bin/eeprom-image.py has a copy
+   * of that layout (LAYOUT), keep it up to date when changing them.
+   */
 
   // Reserve space in the keyboard's EEPROM for the keymaps
+  uint16_t keymap_slices = EEPROMSettings.used();
   EEPROMKeymap.setup(10);
 
   // Reserve space for the number of Colormap layers we will use
@@ -196,14 +253,65 @@ void setup() {
   LEDRainbowWaveEffect.brightness(255);
   StalkerEffect.variant = STALKER(BlazingTrail);
 
+  // Render and sync the LEDs at a fixed frame rate, scan as fast as possible in between
+  LEDFrameScheduler.fps(40);
+
+  // The EEPROM LiveMacros, as long as they can be, for both profiles
+  uint16_t pool_slice = EEPROMSettings.used();
+  StoragePool.reserve(StoragePool.directory_size + 2 * Dygma::plugin::RaiseLiveMacros::eeprom_size);
+  uint16_t setting_slices = EEPROMSettings.used();
+
+  // NKRO or boot protocol, as last chosen with the combo or hid.protocol
+  KeyboardProtocol.setup();
+
+  // Press counters for the key usage heatmap
+  KeyUsage.setup();
+
+  // Two profiles of five layers each, switched with the combo or profile.active
+  ProfileBanks.setup(10, 5);
+
+  /*
+   * Check the slices above in the background. Keymaps, colormaps and macros
+   * are the user's work, so damage there is only reported. The small settings
+   * go back to their defaults. The plugins of this firmware reseal what they
+   * write, the lists name the commands of the Kaleidoscope plugins that write
+   * to a range.
+   */
+  EEPROMScrubber.watch(plugin_slices, LegacyLiveMacros.base(), resetLEDSettings,
+                       PSTR("led.mode\nidleleds.time_limit"));
+  EEPROMScrubber.watch(LegacyLiveMacros.base(), keymap_slices);
+  EEPROMScrubber.watch(keymap_slices, pool_slice, nullptr, PSTR("keymap.custom\npalette\ncolormap.map"));
+  EEPROMScrubber.watch(pool_slice, setting_slices);
+  EEPROMScrubber.watch(setting_slices, EEPROMSettings.used(), EEPROMScrubber.erase);
+  EEPROMScrubber.setup();
+
   // DynamicTapDance.setup(0, 1024);
   // DynamicMacros.reserve_storage(2048);
 
   // EEPROMUpgrade.reserveStorage();
-  // EEPROMUpgrade.upgrade();
+  BootProfiler.mark(BootProfiler.STORAGE_RESERVED);
+
+  // The static RAM of this firmware's own plugins, for mem.stats
+  MemoryStats.track(PSTR("KeyboardProtocol"), KeyboardProtocol.staticRam());
+  MemoryStats.track(PSTR("KeyUsage"), KeyUsage.staticRam());
+  MemoryStats.track(PSTR("ProfileBanks"), ProfileBanks.staticRam());
+  MemoryStats.track(PSTR("EEPROMScrubber"), EEPROMScrubber.staticRam());
+  MemoryStats.track(PSTR("ComboMasks"), ComboMasks.staticRam());
+  MemoryStats.track(PSTR("BootProfiler"), BootProfiler.staticRam());
+  MemoryStats.track(PSTR("StoragePool"), StoragePool.staticRam());
+  MemoryStats.track(PSTR("FocusBuffer"), FocusBuffer.staticRam());
+  MemoryStats.track(PSTR("LEDCapsLockLight"), LEDCapsLockLight.staticRam());
+  MemoryStats.track(PSTR("LEDFrameScheduler"), LEDFrameScheduler.staticRam());
+  MemoryStats.track(PSTR("LiveMacros"), sizeof(LiveMacros));
+
+  BootProfiler.defer(deferredSetup);
+  BootProfiler.mark(BootProfiler.SETUP_DONE);
 }
 
 void loop() {
+#ifdef KALEIDOSCOPE_VIRTUAL_BUILD
+  if (getenv("TRACE_CORPUS"))
+    kaleidoscope::bench::replayTraces();
+#endif
   Kaleidoscope.loop();
-  // protocolBreathe();
 }
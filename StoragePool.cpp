@@ -0,0 +1,216 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::StoragePool -- EEPROM pool for variable size content
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StoragePool.h"
+
+#include <Kaleidoscope-EEPROM-Settings.h>
+#include <Kaleidoscope-FocusSerial.h>
+#include "FocusBuffer.h"
+#include "EEPROMScrubber.h"
+
+namespace kaleidoscope {
+namespace plugin {
+
+StoragePool::Entry StoragePool::directory_[];
+uint8_t StoragePool::entry_count_;
+uint16_t StoragePool::base_;
+uint16_t StoragePool::size_;
+bool StoragePool::loaded_;
+uint8_t StoragePool::generation_;
+
+uint16_t StoragePool::staticRam() {
+  return sizeof(directory_) + sizeof(entry_count_) + sizeof(base_) +
+         sizeof(size_) + sizeof(loaded_) + sizeof(generation_);
+}
+
+void StoragePool::reserve(uint16_t size) {
+  base_ = ::EEPROMSettings.requestSlice(size);
+  size_ = size;
+}
+
+void StoragePool::load() {
+  if (loaded_)
+    return;
+  loaded_ = true;
+
+  /*
+   * The directory ends at the first unused (erased) entry, or at the first
+   * entry that would not fit in the pool anymore.
+   */
+  uint16_t end = dataStart();
+  entry_count_ = 0;
+  for (uint8_t i = 0; i < max_entries; i++) {
+    Entry entry;
+    Runtime.storage().get(base_ + i * sizeof(Entry), entry);
+    if (entry.owner >= OWNER_COUNT || end + entry.length > base_ + size_)
+      break;
+    directory_[entry_count_++] = entry;
+    end += entry.length;
+  }
+}
+
+uint16_t StoragePool::dataEnd() {
+  return blockAt(entry_count_);
+}
+
+uint16_t StoragePool::blockAt(uint8_t index) {
+  uint16_t address = dataStart();
+  for (uint8_t i = 0; i < index; i++)
+    address += directory_[i].length;
+  return address;
+}
+
+int8_t StoragePool::indexOf(uint8_t owner, uint8_t item) {
+  for (uint8_t i = 0; i < entry_count_; i++) {
+    if (directory_[i].owner == owner && directory_[i].item == item)
+      return i;
+  }
+  return -1;
+}
+
+uint16_t StoragePool::find(uint8_t owner, uint8_t item, uint16_t *length) {
+  load();
+  int8_t index = indexOf(owner, item);
+  if (index < 0)
+    return 0;
+
+  if (length)
+    *length = directory_[index].length;
+  return blockAt(index);
+}
+
+uint16_t StoragePool::allocate(uint8_t owner, uint8_t item, uint16_t length) {
+  load();
+
+  // Whatever the old block frees counts, but it stays until the new one is sure to fit
+  int8_t index = indexOf(owner, item);
+  uint16_t freed = index >= 0 ? directory_[index].length : 0;
+  if ((index < 0 && entry_count_ == max_entries) || length > available() + freed)
+    return 0;
+
+  if (index >= 0)
+    removeEntry(index);
+
+  uint16_t address = dataEnd();
+  directory_[entry_count_++] = {owner, item, length};
+  writeDirectory(entry_count_ - 1);
+
+  return address;
+}
+
+void StoragePool::release(uint8_t owner, uint8_t item) {
+  load();
+  int8_t index = indexOf(owner, item);
+  if (index >= 0)
+    removeEntry(index);
+}
+
+void StoragePool::releaseAll(uint8_t owner) {
+  load();
+  for (uint8_t i = entry_count_; i > 0; i--) {
+    if (directory_[i - 1].owner == owner)
+      removeEntry(i - 1);
+  }
+}
+
+void StoragePool::removeEntry(uint8_t index) {
+  // Compact: move every block after this one down over it
+  uint16_t hole = blockAt(index);
+  uint16_t length = directory_[index].length;
+  uint16_t end = dataEnd();
+  for (uint16_t address = hole + length; address < end; address++)
+    Runtime.storage().update(address - length, Runtime.storage().read(address));
+
+  entry_count_--;
+  for (uint8_t i = index; i < entry_count_; i++)
+    directory_[i] = directory_[i + 1];
+  writeDirectory(index);
+}
+
+void StoragePool::writeDirectory(uint8_t from) {
+  for (uint8_t i = from; i < entry_count_; i++)
+    Runtime.storage().put(base_ + i * sizeof(Entry), directory_[i]);
+
+  // Mark the end of the directory, if there is room for it
+  if (entry_count_ < max_entries)
+    Runtime.storage().update(base_ + entry_count_ * sizeof(Entry), NO_OWNER);
+
+  // The blocks moved or are about to be written
+  ::EEPROMScrubber.reseal(base_);
+}
+
+uint16_t StoragePool::used(uint8_t owner) {
+  load();
+  uint16_t total = 0;
+  for (uint8_t i = 0; i < entry_count_; i++) {
+    if (directory_[i].owner == owner)
+      total += directory_[i].length;
+  }
+  return total;
+}
+
+uint16_t StoragePool::available() {
+  load();
+  if (size_ < sizeof(directory_))
+    return 0;
+  return base_ + size_ - dataEnd();
+}
+
+EventHandlerResult StoragePool::onFocusEvent(const char *command) {
+  if (::Focus.handleHelp(command, PSTR("storage.usage\nstorage.directory")))
+    return EventHandlerResult::OK;
+
+  /*
+   * An EEPROM upload rewrites the pool behind our back. We see the command
+   * before FocusEEPROMCommand does, so just forget the directory and read it
+   * again on next use, after the upload is done.
+   */
+  if (strcmp_P(command, PSTR("eeprom.contents")) == 0) {
+    if (!::Focus.isEOL()) {
+      loaded_ = false;
+      generation_++;
+    }
+    return EventHandlerResult::OK;
+  }
+
+  if (strncmp_P(command, PSTR("storage."), 8) != 0)
+    return EventHandlerResult::OK;
+
+  load();
+
+  if (strcmp_P(command + 8, PSTR("usage")) == 0) {
+    // Bytes used by each owner, then the free bytes left in the pool
+    for (uint8_t owner = 0; owner < OWNER_COUNT; owner++)
+      ::Focus.send(used(owner));
+    ::Focus.send(available());
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  if (strcmp_P(command + 8, PSTR("directory")) == 0) {
+    for (uint8_t i = 0; i < entry_count_; i++)
+      ::FocusBuffer.send(directory_[i].owner, directory_[i].item, directory_[i].length);
+    ::FocusBuffer.flush();
+    return EventHandlerResult::EVENT_CONSUMED;
+  }
+
+  return EventHandlerResult::OK;
+}
+
+}
+}
+
+kaleidoscope::plugin::StoragePool StoragePool;
@@ -0,0 +1,106 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::plugin::StoragePool -- EEPROM pool for variable size content
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace plugin {
+
+/*
+ * One EEPROM slice for user content of varying size, where a block only
+ * takes the bytes it needs. LiveMacros is its only owner: every profile's
+ * EEPROM macros go here. The slice starts with a directory of (owner, item,
+ * length) entries, followed by the blocks themselves, packed in directory
+ * order.
+ * Blocks are allocated on demand, and releasing one moves the following
+ * blocks down, so the free space is always in one piece at the end.
+ *
+ * The directory is read on first use, or when load() is called. It is read
+ * again after an eeprom.contents upload, and generation() changes then, so
+ * users caching pool contents know to drop them.
+ *
+ * allocate() replaces the item's block, if it has one. When the new length
+ * does not fit, it returns 0 and leaves the old block as it was.
+ *
+ * Addresses returned by the pool are only valid until the next allocate()
+ * or release() call.
+ */
+class StoragePool: public Plugin {
+ public:
+  enum Owner : uint8_t {
+    LIVE_MACROS,
+    OWNER_COUNT,
+    NO_OWNER = 0xff
+  };
+
+  // Blocks the directory has room for, at 4 bytes each
+  static constexpr uint8_t max_entries = 16;
+  static constexpr uint16_t directory_size = max_entries * 4;
+
+  EventHandlerResult onFocusEvent(const char *command);
+
+  // size counts the directory too
+  static void reserve(uint16_t size);
+  static void load();
+
+  static uint16_t find(uint8_t owner, uint8_t item, uint16_t *length = nullptr);
+  static uint16_t allocate(uint8_t owner, uint8_t item, uint16_t length);
+  static void release(uint8_t owner, uint8_t item);
+  static void releaseAll(uint8_t owner);
+
+  static uint8_t generation() {
+    return generation_;
+  }
+
+  static uint16_t used(uint8_t owner);
+  static uint16_t available();
+
+  // RAM taken by the static members, for mem.stats
+  static uint16_t staticRam();
+
+ private:
+  struct Entry {
+    uint8_t owner;
+    uint8_t item;
+    uint16_t length;
+  };
+
+  static_assert(sizeof(Entry) * max_entries == directory_size, "Update directory_size");
+
+  static Entry directory_[max_entries];
+  static uint8_t entry_count_;
+  static uint16_t base_;
+  static uint16_t size_;
+  static bool loaded_;
+  static uint8_t generation_;
+
+  static uint16_t dataStart() {
+    return base_ + sizeof(directory_);
+  }
+  static uint16_t dataEnd();
+  static uint16_t blockAt(uint8_t index);
+  static int8_t indexOf(uint8_t owner, uint8_t item);
+  static void removeEntry(uint8_t index);
+  static void writeDirectory(uint8_t from);
+};
+
+}
+}
+
+extern kaleidoscope::plugin::StoragePool StoragePool;
@@ -0,0 +1,261 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::bench::TraceReplay -- Replay typing traces on the virtual device
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef KALEIDOSCOPE_VIRTUAL_BUILD
+
+#include "TraceReplay.h"
+
+#include <Kaleidoscope.h>
+#include <HIDReportObserver.h>
+#include "LiveMacros.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope {
+namespace bench {
+
+namespace {
+
+// Layer numbers of the keymap in Raise-Firmware.ino
+constexpr uint8_t qwerty_layer = 0;
+constexpr uint8_t numpad_layer = 1;
+
+// Idle cycles run for each millisecond between two events, and the most of them
+constexpr uint8_t max_idle_cycles = 50;
+// Cycles to wait for the report an event causes
+constexpr uint8_t max_report_cycles = 4;
+
+// Allowed drift from the baseline before calling it a regression
+constexpr double throughput_tolerance = 0.9;
+constexpr double latency_tolerance = 1.1;
+
+struct Event {
+  uint32_t ms;
+  bool down;
+  std::string name;
+  Key key;
+};
+
+struct Result {
+  double events_per_sec;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint32_t reports;
+};
+
+uint32_t reports_sent;
+HIDReportObserver::SendReportHook previous_hook;
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void countReport(uint8_t id, const void *data, int len, int result) {
+  if (previous_hook)
+    previous_hook(id, data, len, result);
+  reports_sent++;
+}
+
+// -- Virtual device glue -------------------------------------------------------
+
+void setKeystate(KeyAddr key_addr, bool pressed) {
+  Runtime.device().keyScanner().setKeystate(key_addr,
+      pressed ? device::virt::PRESSED : device::virt::NOT_PRESSED);
+}
+
+// ------------------------------------------------------------------------------
+
+bool parseKey(const char *name, Key &key) {
+  if (strncmp(name, "0x", 2) == 0) {
+    key = Key(strtoul(name, nullptr, 16), KEY_FLAGS);
+  } else if (strcmp(name, "LM_RECORD") == 0) {
+    key = LM_RECORD;
+  } else if (strncmp(name, "LM_M", 4) == 0) {
+    key = LM_M(atoi(name + 4));
+  } else if (strcmp(name, "TO_NUMPAD") == 0) {
+    key = MoveToLayer(numpad_layer);
+  } else if (strcmp(name, "TO_QWERTY") == 0) {
+    key = MoveToLayer(qwerty_layer);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool loadTrace(const std::string &path, std::vector<Event> &events) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f)
+    return false;
+
+  char line[128], direction[8], name[32];
+  unsigned long ms;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || sscanf(line, "%lu %7s %31s", &ms, direction, name) != 3)
+      continue;
+    Event event = {static_cast<uint32_t>(ms), strcmp(direction, "down") == 0, name, Key_NoKey};
+    if (!parseKey(name, event.key)) {
+      fprintf(stderr, "%s: unknown key %s\n", path.c_str(), name);
+      continue;
+    }
+    events.push_back(event);
+  }
+  fclose(f);
+  return true;
+}
+
+KeyAddr findKey(Key key) {
+  for (auto key_addr : KeyAddr::all()) {
+    if (Layer.lookupOnActiveLayer(key_addr) == key)
+      return key_addr;
+  }
+  return KeyAddr(KeyAddr::invalid_state);
+}
+
+Result replay(const std::vector<Event> &events) {
+  std::map<std::string, KeyAddr> held;
+  std::vector<uint64_t> latencies;
+  uint32_t last_ms = 0;
+
+  Layer.move(qwerty_layer);
+  reports_sent = 0;
+  uint64_t start = now();
+
+  for (const Event &event : events) {
+    uint32_t idle = std::min<uint32_t>(event.ms - last_ms, max_idle_cycles);
+    for (uint32_t i = 0; i < idle; i++)
+      Runtime.loop();
+    last_ms = event.ms;
+
+    KeyAddr key_addr;
+    if (event.down) {
+      key_addr = findKey(event.key);
+      held[event.name] = key_addr;
+    } else {
+      key_addr = held[event.name];
+      held.erase(event.name);
+    }
+    if (!key_addr.isValid())
+      continue;
+
+    uint32_t reports_before = reports_sent;
+    uint64_t event_start = now();
+    setKeystate(key_addr, event.down);
+    for (uint8_t i = 0; i < max_report_cycles && reports_sent == reports_before; i++)
+      Runtime.loop();
+    if (reports_sent != reports_before)
+      latencies.push_back(now() - event_start);
+  }
+
+  Result result = {0, 0, 0, reports_sent};
+  result.events_per_sec = events.size() * 1e9 / (now() - start);
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    result.p50_ns = latencies[latencies.size() / 2];
+    result.p99_ns = latencies[latencies.size() * 99 / 100];
+  }
+  return result;
+}
+
+std::map<std::string, Result> loadBaseline(const char *path) {
+  std::map<std::string, Result> baseline;
+  if (!path)
+    return baseline;
+
+  // Asked to compare, but with nothing to compare against
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "No baseline at %s, record one with make bench-baseline\n", path);
+    exit(1);
+  }
+
+  char line[256], name[128];
+  Result r;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%127s events_per_sec=%lf p50_ns=%lu p99_ns=%lu reports=%u",
+               name, &r.events_per_sec, &r.p50_ns, &r.p99_ns, &r.reports) == 5)
+      baseline[name] = r;
+  }
+  fclose(f);
+  return baseline;
+}
+
+}
+
+void replayTraces() {
+  const char *corpus = getenv("TRACE_CORPUS");
+  std::map<std::string, Result> baseline = loadBaseline(getenv("TRACE_BASELINE"));
+  int regressions = 0;
+
+  Runtime.device().keyScanner().setEnableReadMatrix(false);
+  previous_hook = HIDReportObserver::resetHook(countReport);
+
+  DIR *dir = opendir(corpus ? corpus : "bench/synthetic-corpus");
+  if (!dir) {
+    fprintf(stderr, "No trace corpus, set TRACE_CORPUS\n");
+    exit(1);
+  }
+
+  std::vector<std::string> traces;
+  while (struct dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > 6 && name.compare(name.size() - 6, 6, ".trace") == 0)
+      traces.push_back(name);
+  }
+  closedir(dir);
+  std::sort(traces.begin(), traces.end());
+
+  for (const std::string &name : traces) {
+    std::vector<Event> events;
+    loadTrace(std::string(corpus ? corpus : "bench/synthetic-corpus") + "/" + name, events);
+    Result r = replay(events);
+    printf("%s events_per_sec=%.0f p50_ns=%lu p99_ns=%lu reports=%u\n",
+           name.c_str(), r.events_per_sec, r.p50_ns, r.p99_ns, r.reports);
+
+    if (baseline.empty())
+      continue;
+    auto base = baseline.find(name);
+    if (base == baseline.end()) {
+      fprintf(stderr, "%s: not in the baseline, record it again\n", name.c_str());
+      regressions++;
+      continue;
+    }
+    const Result &b = base->second;
+    if (r.events_per_sec < b.events_per_sec * throughput_tolerance ||
+        r.p99_ns > b.p99_ns * latency_tolerance ||
+        r.reports != b.reports) {
+      fprintf(stderr, "%s: regression against the baseline\n", name.c_str());
+      regressions++;
+    }
+  }
+
+  exit(regressions ? 1 : 0);
+}
+
+}
+}
+
+#endif
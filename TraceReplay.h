@@ -0,0 +1,41 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::bench::TraceReplay -- Replay typing traces on the virtual device
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef KALEIDOSCOPE_VIRTUAL_BUILD
+
+namespace kaleidoscope {
+namespace bench {
+
+/*
+ * Pushes every trace in the $TRACE_CORPUS directory through the whole plugin
+ * chain of the sketch, one event at a time, and prints for each trace the
+ * events per second, the p50/p99 time from a keyswitch event to the HID
+ * report it caused, and the number of reports sent. When $TRACE_BASELINE names
+ * a file of earlier results, each trace is compared against it and the
+ * process exits with an error on a regression, on a trace the baseline does
+ * not have, or when the file is missing.
+ *
+ * Never returns.
+ */
+void replayTraces();
+
+}
+}
+
+#endif
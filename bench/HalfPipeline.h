@@ -0,0 +1,202 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::raise::HalfPipeline -- Background communication with the halves
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace kaleidoscope {
+namespace raise {
+
+namespace half_pipeline {
+
+// LED packets of LedBytes per side, so a whole LED frame is sides * banks_per_side packets
+constexpr uint8_t banks_per_side = 11;
+
+}
+
+/*
+ * Keeps the bus to the two halves busy in the background, so the main loop
+ * never waits for a transfer.
+ *
+ * The halves are polled for their key state one after the other, without a
+ * pause. Each side has two key frame buffers: the bus fills one while the
+ * other holds the newest complete frame, which takeKeys() copies out. LED
+ * packets are queued, and one goes out after every round of key reads. A
+ * packet for a bank that is already waiting in the queue replaces it, so a
+ * slow bus drops stale LED frames rather than falling behind. The queue holds
+ * a whole LED frame by default; with a shorter one, queueLeds() refuses the
+ * packets that do not fit and counts them in Stats::dropped.
+ *
+ * The Bus does the transfers asynchronously and calls the function given to
+ * onDone() when one finishes, from its interrupt on hardware:
+ *
+ *   void onDone(void (*done)(void *context, bool ok), void *context);
+ *   void startRead(uint8_t side, uint8_t *buffer, uint8_t length);
+ *   void startWrite(uint8_t side, uint8_t bank, const uint8_t *data, uint8_t length);
+ *   struct CriticalSection;  // keeps the completion callback out while in scope,
+ *                            // with a user-provided constructor
+ *
+ * It lives with the bench, its only user. On the keyboard, the Raise device
+ * driver polls the halves with blocking TWI transfers from the main loop, and
+ * that driver is not part of this firmware. Using the pipeline there takes a
+ * SERCOM Bus and a driver calling takeKeys() and queueLeds() instead, not a
+ * change to this sketch.
+ */
+template <typename Bus, uint8_t KeyBytes = 5, uint8_t LedBytes = 24,
+          uint8_t LedQueueDepth = 2 * half_pipeline::banks_per_side>
+class HalfPipeline {
+ public:
+  static constexpr uint8_t sides = 2;
+
+  struct Stats {
+    uint32_t key_frames;
+    uint32_t led_packets;
+    uint32_t coalesced;
+    uint32_t dropped;
+    uint32_t errors;
+  };
+
+  explicit HalfPipeline(Bus &bus) : bus_(bus) {}
+
+  void begin() {
+    bus_.onDone(transferDone, this);
+    typename Bus::CriticalSection lock;
+    startNext();
+  }
+
+  // Copies the newest key frame of a side, returns whether it is new since the last call
+  bool takeKeys(uint8_t side, uint8_t *keys) {
+    typename Bus::CriticalSection lock;
+    KeyFrames &frames = keys_[side];
+    memcpy(keys, frames.data[frames.latest], KeyBytes);
+    bool fresh = frames.fresh;
+    frames.fresh = false;
+    return fresh;
+  }
+
+  // Returns false when the queue is full and the packet was dropped
+  bool queueLeds(uint8_t side, uint8_t bank, const uint8_t *leds) {
+    typename Bus::CriticalSection lock;
+
+    // The packet at the head may be on the bus right now, leave it alone
+    uint8_t first = transfer_ == WRITE_LEDS ? 1 : 0;
+    for (uint8_t i = first; i < led_count_; i++) {
+      LedPacket &packet = leds_[(led_head_ + i) % LedQueueDepth];
+      if (packet.side == side && packet.bank == bank) {
+        memcpy(packet.data, leds, LedBytes);
+        stats_.coalesced++;
+        return true;
+      }
+    }
+
+    if (led_count_ == LedQueueDepth) {
+      stats_.dropped++;
+      return false;
+    }
+
+    LedPacket &packet = leds_[(led_head_ + led_count_) % LedQueueDepth];
+    packet.side = side;
+    packet.bank = bank;
+    memcpy(packet.data, leds, LedBytes);
+    led_count_++;
+    return true;
+  }
+
+  uint8_t queuedLeds() const {
+    return led_count_;
+  }
+
+  Stats stats() {
+    typename Bus::CriticalSection lock;
+    return stats_;
+  }
+
+ private:
+  enum Transfer : uint8_t {
+    IDLE,
+    READ_KEYS,
+    WRITE_LEDS,
+  };
+
+  struct KeyFrames {
+    uint8_t data[2][KeyBytes];
+    uint8_t latest;
+    bool fresh;
+  };
+
+  struct LedPacket {
+    uint8_t side;
+    uint8_t bank;
+    uint8_t data[LedBytes];
+  };
+
+  Bus &bus_;
+  KeyFrames keys_[sides] = {};
+  LedPacket leds_[LedQueueDepth];
+  volatile uint8_t led_head_ = 0;
+  volatile uint8_t led_count_ = 0;
+  volatile Transfer transfer_ = IDLE;
+  uint8_t side_ = 0;
+  uint8_t reads_since_leds_ = 0;
+  Stats stats_ = {};
+
+  // Called with the completion callback locked out, or from it
+  void startNext() {
+    if (led_count_ && reads_since_leds_ >= sides) {
+      reads_since_leds_ = 0;
+      transfer_ = WRITE_LEDS;
+      const LedPacket &packet = leds_[led_head_];
+      bus_.startWrite(packet.side, packet.bank, packet.data, LedBytes);
+      return;
+    }
+
+    side_ = (side_ + 1) % sides;
+    reads_since_leds_++;
+    transfer_ = READ_KEYS;
+    KeyFrames &frames = keys_[side_];
+    bus_.startRead(side_, frames.data[frames.latest ^ 1], KeyBytes);
+  }
+
+  static void transferDone(void *context, bool ok) {
+    HalfPipeline *self = static_cast<HalfPipeline *>(context);
+
+    if (!ok)
+      self->stats_.errors++;
+
+    if (self->transfer_ == READ_KEYS) {
+      if (ok) {
+        KeyFrames &frames = self->keys_[self->side_];
+        frames.latest ^= 1;
+        frames.fresh = true;
+        self->stats_.key_frames++;
+      }
+    } else if (self->transfer_ == WRITE_LEDS) {
+      // A failed packet is not retried, the next LED frame resends the bank
+      self->led_head_ = (self->led_head_ + 1) % LedQueueDepth;
+      self->led_count_--;
+      if (ok)
+        self->stats_.led_packets++;
+    }
+
+    self->startNext();
+  }
+};
+
+}
+}
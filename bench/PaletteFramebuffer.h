@@ -0,0 +1,183 @@
+/* -*- mode: c++ -*-
+ * kaleidoscope::raise::PaletteFramebuffer -- Palette-indexed LED framebuffer
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace kaleidoscope {
+namespace raise {
+
+/*
+ * The LEDs of one half as 4 bit indices into a 16 color palette, the same
+ * palette LEDPaletteTheme limits colormaps to, plus a short list of LEDs with
+ * a full color of their own for the keys that animate, like the CapsLock and
+ * LiveMacros highlights.
+ *
+ * flush() hands what changed since the last flush to a sender, as three kinds
+ * of packets: the palette, banks of BankSize indices, and the override list.
+ * A static colormap costs the palette and the index banks once, and nothing
+ * after that. An animated key only resends the override list.
+ *
+ * For one 72 LED half, bench/palette-frames.cpp measures 121 bytes of RAM
+ * against 216 for full colors, 44% less, since the palette and the override
+ * list are fixed costs. A static colormap takes 95 bytes on the link against
+ * 225, 58% less. With animated keys, the link carries 26% of the full color
+ * bytes.
+ *
+ * Only the bench uses it. The halves run a prebuilt firmware that takes full
+ * color banks, and the LED sync is in the Raise device driver, outside this
+ * sketch: both need the three packet kinds before the keyboard can use it.
+ */
+template <typename Color, uint8_t LedCount, uint8_t MaxOverrides = 8, uint8_t BankSize = 8>
+class PaletteFramebuffer {
+  static_assert(BankSize % 2 == 0, "A bank has to fill whole bytes of two indices");
+
+ public:
+  static constexpr uint8_t palette_size = 16;
+  static constexpr uint8_t banks = (LedCount + BankSize - 1) / BankSize;
+  static constexpr uint8_t bank_bytes = BankSize / 2;
+
+  enum Packet : uint8_t {
+    PALETTE,
+    INDICES,
+    OVERRIDES,
+  };
+
+  struct Override {
+    uint8_t led;
+    Color color;
+  };
+
+  PaletteFramebuffer() {
+    invalidate();
+  }
+
+  // Returns false for an index past the palette
+  bool setPalette(uint8_t index, const Color &color) {
+    if (index >= palette_size)
+      return false;
+    if (memcmp(&palette_[index], &color, sizeof(Color)) == 0)
+      return true;
+    palette_[index] = color;
+    palette_dirty_ = true;
+    return true;
+  }
+
+  void setIndex(uint8_t led, uint8_t index) {
+    clearOverride(led);
+
+    uint8_t &pair = indices_[led / 2];
+    uint8_t shift = (led & 1) * 4;
+    uint8_t updated = (pair & ~(0x0f << shift)) | ((index & 0x0f) << shift);
+    if (updated == pair)
+      return;
+    pair = updated;
+    dirty_banks_[led / BankSize / 8] |= 1 << (led / BankSize % 8);
+  }
+
+  uint8_t index(uint8_t led) const {
+    return (indices_[led / 2] >> ((led & 1) * 4)) & 0x0f;
+  }
+
+  // Returns false when the override list is full
+  bool setOverride(uint8_t led, const Color &color) {
+    Override *slot = findOverride(led);
+    if (!slot) {
+      if (override_count_ == MaxOverrides)
+        return false;
+      slot = &overrides_[override_count_++];
+      slot->led = led;
+    } else if (memcmp(&slot->color, &color, sizeof(Color)) == 0) {
+      return true;
+    }
+    slot->color = color;
+    overrides_dirty_ = true;
+    return true;
+  }
+
+  void clearOverride(uint8_t led) {
+    Override *slot = findOverride(led);
+    if (!slot)
+      return;
+    *slot = overrides_[--override_count_];
+    overrides_dirty_ = true;
+  }
+
+  Color color(uint8_t led) const {
+    for (uint8_t i = 0; i < override_count_; i++) {
+      if (overrides_[i].led == led)
+        return overrides_[i].color;
+    }
+    return palette_[index(led)];
+  }
+
+  // Marks everything for sending, after the half was reset for example
+  void invalidate() {
+    palette_dirty_ = true;
+    overrides_dirty_ = true;
+    memset(dirty_banks_, 0xff, sizeof(dirty_banks_));
+  }
+
+  /*
+   * Calls send(Packet kind, uint8_t bank, const uint8_t *data, uint8_t length)
+   * for every packet that changed. The palette goes first, so indices never
+   * point at colors the half does not have yet.
+   */
+  template <typename Send>
+  void flush(Send send) {
+    if (palette_dirty_) {
+      send(PALETTE, 0, reinterpret_cast<const uint8_t *>(palette_), sizeof(palette_));
+      palette_dirty_ = false;
+    }
+
+    for (uint8_t bank = 0; bank < banks; bank++) {
+      if (!(dirty_banks_[bank / 8] & (1 << (bank % 8))))
+        continue;
+      send(INDICES, bank, &indices_[bank * bank_bytes], bank_bytes);
+    }
+    memset(dirty_banks_, 0, sizeof(dirty_banks_));
+
+    if (overrides_dirty_) {
+      send(OVERRIDES, override_count_, reinterpret_cast<const uint8_t *>(overrides_),
+           override_count_ * sizeof(Override));
+      overrides_dirty_ = false;
+    }
+  }
+
+ private:
+  Color palette_[palette_size] = {};
+  uint8_t indices_[banks * bank_bytes] = {};
+  Override overrides_[MaxOverrides];
+  uint8_t override_count_ = 0;
+
+  uint8_t dirty_banks_[(banks + 7) / 8];
+  bool palette_dirty_;
+  bool overrides_dirty_;
+
+  Override *findOverride(uint8_t led) {
+    for (uint8_t i = 0; i < override_count_; i++) {
+      if (overrides_[i].led == led)
+        return &overrides_[i];
+    }
+    return nullptr;
+  }
+};
+
+}
+}
@@ -0,0 +1,149 @@
+/* -*- mode: c++ -*-
+ * SimulatedHalfBus -- A host stand-in for the bus to the keyboard halves
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <utility>
+
+/*
+ * Implements the Bus of HalfPipeline on a host, on a simulated clock rather
+ * than in real time, so results do not depend on the load or the core count
+ * of the machine running it.
+ *
+ * Every transfer takes a fixed setup time plus a time per byte. The code
+ * under test spends time with advance(), which runs whatever happens in that
+ * time in order: transfer completions, whose callback runs as the interrupt
+ * would and may start the next transfer, and the key changes scheduled with
+ * schedule(). Key reads return the state of the half when they complete.
+ *
+ * Callbacks only run inside advance(), so CriticalSection has nothing to do.
+ */
+class SimulatedHalfBus {
+ public:
+  typedef void (*Done)(void *context, bool ok);
+
+  static constexpr uint8_t sides = 2;
+  static constexpr uint8_t key_bytes = 5;
+
+  struct CriticalSection {
+    // User-provided, like a real one, so the unused locks don't warn
+    CriticalSection() {}
+  };
+
+  SimulatedHalfBus(uint32_t setup_ns, uint32_t byte_ns)
+    : setup_ns_(setup_ns), byte_ns_(byte_ns) {}
+
+  uint64_t now() const {
+    return now_;
+  }
+
+  void onDone(Done done, void *context) {
+    done_ = done;
+    context_ = context;
+  }
+
+  void startRead(uint8_t side, uint8_t *buffer, uint8_t length) {
+    start(side, buffer, length);
+  }
+
+  void startWrite(uint8_t side, uint8_t, const uint8_t *, uint8_t length) {
+    // +1 for the bank byte
+    start(side, nullptr, length + 1);
+  }
+
+  // Blocking transfers, as the main loop does without the pipeline
+  void read(uint8_t side, uint8_t *buffer, uint8_t length) {
+    advance(transferTime(length));
+    memcpy(buffer, matrix_[side], length);
+  }
+
+  void write(uint8_t, uint8_t, const uint8_t *, uint8_t length) {
+    advance(transferTime(length + 1));
+  }
+
+  // Presses or releases a key of a half at a given time
+  void schedule(uint64_t at, uint8_t side, uint8_t row, uint8_t col, bool pressed) {
+    changes_.insert(std::make_pair(at, Change{side, row, col, pressed}));
+  }
+
+  void advance(uint64_t ns) {
+    uint64_t end = now_ + ns;
+    while (true) {
+      bool change_due = !changes_.empty() && changes_.begin()->first <= end;
+      bool transfer_due = busy_ && transfer_end_ <= end;
+      if (!change_due && !transfer_due)
+        break;
+
+      if (change_due && (!transfer_due || changes_.begin()->first <= transfer_end_)) {
+        now_ = changes_.begin()->first;
+        const Change &change = changes_.begin()->second;
+        if (change.pressed)
+          matrix_[change.side][change.row] |= 1 << change.col;
+        else
+          matrix_[change.side][change.row] &= ~(1 << change.col);
+        changes_.erase(changes_.begin());
+      } else {
+        now_ = transfer_end_;
+        busy_ = false;
+        if (buffer_)
+          memcpy(buffer_, matrix_[side_], length_);
+        if (done_)
+          done_(context_, true);
+      }
+    }
+    now_ = end;
+  }
+
+ private:
+  struct Change {
+    uint8_t side;
+    uint8_t row;
+    uint8_t col;
+    bool pressed;
+  };
+
+  uint32_t setup_ns_;
+  uint32_t byte_ns_;
+  uint64_t now_ = 0;
+
+  bool busy_ = false;
+  uint64_t transfer_end_;
+  uint8_t side_;
+  uint8_t *buffer_;
+  uint8_t length_;
+
+  Done done_ = nullptr;
+  void *context_ = nullptr;
+  uint8_t matrix_[sides][key_bytes] = {};
+  std::multimap<uint64_t, Change> changes_;
+
+  uint64_t transferTime(uint8_t length) const {
+    return setup_ns_ + uint64_t(length) * byte_ns_;
+  }
+
+  void start(uint8_t side, uint8_t *buffer, uint8_t length) {
+    busy_ = true;
+    transfer_end_ = now_ + transferTime(length);
+    side_ = side;
+    buffer_ = buffer;
+    length_ = length;
+  }
+};
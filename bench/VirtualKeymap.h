@@ -0,0 +1,73 @@
+/* -*- mode: c++ -*-
+ * VirtualKeymap -- The sketch's keymap and combos for the virtual bench device
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Included by Raise-Firmware.ino in place of its own keymap and combos when
+ * it is built for the replay benchmark (make build-virtual). That runs on the
+ * Model 01 virtual device, which has a different matrix: the same layers,
+ * with the keys the trace corpus uses where the Model 01 has room for them.
+ * The replay finds keys by their value, not their position, so this only
+ * needs to follow the sketch's keymap when a trace uses a new key.
+ */
+
+#pragma once
+
+// *INDENT-OFF*
+
+KEYMAPS(
+[QWERTY] = KEYMAP_STACKED
+(
+    Key_Escape      ,Key_1 ,Key_2 ,Key_3 ,Key_4 ,Key_5 ,Key_6
+   ,Key_Tab         ,Key_Q ,Key_W ,Key_E ,Key_R ,Key_T ,Key_Home
+   ,Key_CapsLock    ,Key_A ,Key_S ,Key_D ,Key_F ,Key_G
+   ,Key_LeftShift   ,Key_Z ,Key_X ,Key_C ,Key_V ,Key_B ,Key_Delete
+   ,Key_LeftControl ,Key_Backspace ,Key_LeftGui ,Key_LeftAlt
+   ,Key_Space
+
+   ,Key_7               ,Key_8 ,Key_9 ,Key_0     ,Key_Minus  ,Key_Equals    ,Key_Backspace
+   ,Key_Enter           ,Key_Y ,Key_U ,Key_I     ,Key_O      ,Key_P         ,Key_LeftBracket
+                        ,Key_H ,Key_J ,Key_K     ,Key_L      ,Key_Semicolon ,Key_Quote
+   ,Key_LEDEffectNext   ,Key_N ,Key_M ,Key_Comma ,Key_Period ,Key_Slash     ,Key_RightShift
+   ,Key_RightControl    ,Key_RightAlt ,Key_Space ,Key_End
+   ,MoveToLayer(NUMPAD)
+),
+
+[NUMPAD] = KEYMAP_STACKED
+(
+    Key_Escape      ,Key_F1        ,Key_F2        ,Key_F3         ,Key_F4  ,Key_F5  ,Key_F6
+   ,Key_Tab         ,LM_RECORD     ,Key_UpArrow   ,LM_M(0)        ,LM_M(1) ,LM_M(2) ,Key_Home
+   ,Key_CapsLock    ,Key_LeftArrow ,Key_DownArrow ,Key_RightArrow ,LM_M(3) ,LM_M(4)
+   ,Key_LeftShift   ,LM_M(5)       ,LM_M(6)       ,LM_M(7)        ,XXX     ,XXX     ,Key_Delete
+   ,Key_LeftControl ,Key_Backspace ,Key_LeftGui   ,Key_LeftAlt
+   ,Key_Space
+
+   ,Key_F7              ,Key_F8   ,Key_F9   ,Key_F10   ,Key_F11            ,Key_F12 ,Key_Backspace
+   ,Key_Enter           ,Key_KeypadSubtract ,Key_7     ,Key_8   ,Key_9     ,Key_KeypadDivide ,XXX
+                        ,Key_KeypadAdd      ,Key_4     ,Key_5   ,Key_6     ,Key_KeypadMultiply ,XXX
+   ,XXX                 ,Key_KeypadDot      ,Key_1     ,Key_2   ,Key_3     ,Key_0   ,Key_RightShift
+   ,Key_RightControl    ,Key_RightAlt       ,Key_Space ,Key_End
+   ,MoveToLayer(QWERTY)
+ )
+);
+
+// *INDENT-ON*
+
+USE_COMBO_MASKS(
+    // The sketch's chords, at the Model 01 positions of those keys
+    COMBO(toggleKeyboardProtocol, R0C7, R3C0, R3C7, R0C6),
+    COMBO(nextProfile, R0C7, R3C0, R3C7, R0C5)
+);
@@ -0,0 +1,256 @@
+/* -*- mode: c++ -*-
+ * combo-match -- MagicCombo list scans vs. ComboMatcher
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Feeds the same typing, with a combo chord now and then, to a copy of
+ * MagicCombo's beforeReportingState() scan and to ComboMatcher, for growing
+ * numbers of combos, and prints the time each spends per main loop cycle.
+ *
+ * MagicCombo goes through every combo on every cycle, key by key, and asks
+ * for the number of keys held once per combo. Here that count is a popcount
+ * over the key bitmap, which is cheaper than on the keyboard. ComboMatcher
+ * only runs on key events. Both have to fire the same combos, the run fails
+ * otherwise.
+ *
+ * The times are host times: compare the two columns, not the numbers.
+ *
+ * Usage: combo-match [cycles] [cycles_per_event]
+ */
+
+#include "../ComboMatcher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace {
+
+using kaleidoscope::raise::ComboMatcher;
+namespace combo_matcher = kaleidoscope::raise::combo_matcher;
+
+constexpr uint8_t keys = 80;
+constexpr uint8_t max_combo_length = 5;
+
+volatile uint32_t fired;
+
+void action(uint8_t) {
+  fired++;
+}
+
+// combo() does its work in the compiler, as USE_COMBO_MASKS uses it
+constexpr combo_matcher::Combo example = combo_matcher::combo(action, 1, 33, 70);
+static_assert(example.mask[0] == 1u << 1 && example.mask[1] == 1u << 1 && example.mask[2] == 1u << 6, "");
+static_assert(example.hash == (combo_matcher::keyHash(1) ^ combo_matcher::keyHash(33) ^ combo_matcher::keyHash(70)), "");
+static_assert(example.length == 3 && combo_matcher::tableSize(50) == 128, "");
+
+// As MagicCombo keeps them: key indexes, ended by 0
+struct MagicCombo {
+  combo_matcher::Action action;
+  int8_t keys[max_combo_length + 1];
+};
+
+struct Held {
+  uint32_t words[combo_matcher::words] = {};
+
+  bool pressed(int8_t key) const {
+    return words[key / 32] & (uint32_t(1) << (key % 32));
+  }
+  uint8_t count() const {
+    uint8_t count = 0;
+    for (uint32_t word : words)
+      count += __builtin_popcount(word);
+    return count;
+  }
+  void set(uint8_t key, bool down) {
+    if (down)
+      words[key / 32] |= uint32_t(1) << (key % 32);
+    else
+      words[key / 32] &= ~(uint32_t(1) << (key % 32));
+  }
+};
+
+struct Event {
+  uint32_t cycle;
+  uint8_t key;
+  bool pressed;
+};
+
+// Distinct combos of 2 to 4 keys, never key 0, which ends a MagicCombo
+std::vector<std::vector<uint8_t>> makeCombos(uint8_t count, std::mt19937 &random) {
+  std::uniform_int_distribution<int> key(1, keys - 1), length(2, 4);
+  std::set<std::vector<uint8_t>> seen;
+  std::vector<std::vector<uint8_t>> combos;
+  while (combos.size() < count) {
+    std::set<uint8_t> chord;
+    for (int n = length(random); int(chord.size()) < n;)
+      chord.insert(key(random));
+    std::vector<uint8_t> combo(chord.begin(), chord.end());
+    if (seen.insert(combo).second)
+      combos.push_back(combo);
+  }
+  return combos;
+}
+
+// Rolling typing, one or two keys down at a time, and a combo chord every 100 strokes
+std::vector<Event> makeEvents(const std::vector<std::vector<uint8_t>> &combos, uint32_t cycles,
+                              uint32_t cycles_per_event, std::mt19937 &random) {
+  std::uniform_int_distribution<int> key(0, keys - 1);
+  std::uniform_int_distribution<size_t> pick(0, combos.size() - 1);
+  std::vector<Event> events;
+  std::vector<uint8_t> down;
+  uint32_t cycle = cycles_per_event;
+  auto next = [&]() {
+    uint32_t at = cycle;
+    cycle += cycles_per_event;
+    return at;
+  };
+
+  for (uint32_t strokes = 1; cycle < cycles; strokes++) {
+    if (strokes % 100 == 0) {
+      // Let go of everything, press the chord a key at a time, release it at once
+      for (uint8_t k : down)
+        events.push_back({next(), k, false});
+      down.clear();
+      const std::vector<uint8_t> &chord = combos[pick(random)];
+      for (uint8_t k : chord)
+        events.push_back({next(), k, true});
+      uint32_t at = next();
+      for (uint8_t k : chord)
+        events.push_back({at, k, false});
+    } else if (down.size() < 2) {
+      uint8_t k = key(random);
+      if (std::find(down.begin(), down.end(), k) == down.end()) {
+        events.push_back({next(), k, true});
+        down.push_back(k);
+      }
+    } else {
+      events.push_back({next(), down.front(), false});
+      down.erase(down.begin());
+    }
+  }
+  return events;
+}
+
+double magicCombo(const std::vector<MagicCombo> &combos, const std::vector<Event> &events,
+                  uint32_t cycles, uint32_t &completions) {
+  Held held;
+  std::vector<bool> matched(combos.size());
+  size_t next = 0;
+  completions = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+    for (; next < events.size() && events[next].cycle == cycle; next++)
+      held.set(events[next].key, events[next].pressed);
+
+    // MagicCombo::beforeReportingState()
+    for (uint8_t i = 0; i < combos.size(); i++) {
+      bool match = true;
+      uint8_t j;
+      for (j = 0; j < max_combo_length; j++) {
+        int8_t combo_key = combos[i].keys[j];
+        if (combo_key == 0)
+          break;
+        match &= held.pressed(combo_key);
+        if (!match)
+          break;
+      }
+      if (j != held.count())
+        match = false;
+      // MagicCombo repeats while held, count a combo once per hold here
+      if (match && !matched[i]) {
+        combos[i].action(i);
+        completions++;
+      }
+      matched[i] = match;
+    }
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+double comboMatcher(const std::vector<ComboMatcher::Combo> &combos, const std::vector<Event> &events,
+                    uint32_t cycles, uint32_t &completions) {
+  std::vector<uint8_t> table(combo_matcher::tableSize(combos.size()));
+  ComboMatcher matcher;
+  matcher.begin(combos.data(), combos.size(), table.data(), table.size());
+  size_t next = 0;
+  completions = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+    for (; next < events.size() && events[next].cycle == cycle; next++) {
+      const Event &event = events[next];
+      if (event.pressed) {
+        uint8_t index = matcher.press(event.key);
+        if (index != ComboMatcher::no_combo) {
+          combos[index].action(index);
+          completions++;
+        }
+      } else {
+        matcher.release(event.key);
+      }
+    }
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+  uint32_t cycles = argc > 1 ? atoi(argv[1]) : 2000000;
+  uint32_t cycles_per_event = argc > 2 ? atoi(argv[2]) : 20;
+
+  printf("%u cycles, a key event every %u cycles\n\n", cycles, cycles_per_event);
+  printf("%7s %8s %12s %12s %8s %10s\n", "combos", "events", "MagicCombo", "matcher", "speedup", "fired");
+
+  int failures = 0;
+  for (uint8_t count : {2, 8, 16, 32, 50, 64}) {
+    std::mt19937 random(count);
+    auto chords = makeCombos(count, random);
+    auto events = makeEvents(chords, cycles, cycles_per_event, random);
+
+    std::vector<MagicCombo> magic;
+    std::vector<ComboMatcher::Combo> masks;
+    for (const auto &chord : chords) {
+      MagicCombo entry = {action, {}};
+      ComboMatcher::Combo combo = {action, {}, 0, uint8_t(chord.size())};
+      for (size_t i = 0; i < chord.size(); i++) {
+        entry.keys[i] = chord[i];
+        combo.mask[chord[i] / 32] |= uint32_t(1) << (chord[i] % 32);
+        combo.hash ^= combo_matcher::keyHash(chord[i]);
+      }
+      magic.push_back(entry);
+      masks.push_back(combo);
+    }
+
+    uint32_t magic_fired, matcher_fired;
+    double magic_ns = magicCombo(magic, events, cycles, magic_fired);
+    double matcher_ns = comboMatcher(masks, events, cycles, matcher_fired);
+
+    printf("%7u %8zu %9.2fns %9.2fns %7.0fx %5u/%-5u%s\n", count, events.size(),
+           magic_ns / cycles, matcher_ns / cycles, magic_ns / matcher_ns, matcher_fired, magic_fired,
+           matcher_fired == magic_fired ? "" : "  MISMATCH");
+    failures += matcher_fired != magic_fired;
+  }
+  printf("\nPer cycle, key events included.\n");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/* -*- mode: c++ -*-
+ * half-pipeline -- Blocking vs. background communication with the halves
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the same main loop twice over SimulatedHalfBus: once reading the halves
+ * and sending the LED frames with blocking transfers, as the firmware does
+ * now, and once through HalfPipeline. The same key presses and releases, at
+ * random times, happen on the left half in both runs. For each run it prints
+ * the main loop cycle time and the time from a key changing on a half to the
+ * main loop seeing it, in simulated time.
+ *
+ * Usage: half-pipeline [seconds] [setup_us] [byte_us] [work_us]
+ */
+
+#include "HalfPipeline.h"
+#include "SimulatedHalfBus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr uint8_t sides = SimulatedHalfBus::sides;
+constexpr uint8_t key_bytes = SimulatedHalfBus::key_bytes;
+constexpr uint8_t led_bytes = 24;
+constexpr uint8_t banks_per_side = kaleidoscope::raise::half_pipeline::banks_per_side;
+constexpr uint64_t frame_interval_ns = 25000000;
+
+// The key the simulated typist uses
+constexpr uint8_t row = 2, col = 3;
+
+typedef kaleidoscope::raise::HalfPipeline<SimulatedHalfBus, key_bytes, led_bytes> Pipeline;
+
+struct Run {
+  std::vector<double> cycle_us;
+  std::vector<double> latency_us;
+  size_t missed = 0;
+};
+
+// Flips the key every 2 to 8 ms, the same way for every run
+std::vector<uint64_t> typist(uint64_t duration) {
+  std::vector<uint64_t> changes;
+  std::mt19937 random(1);
+  std::uniform_int_distribution<uint64_t> pause(2000000, 8000000);
+  for (uint64_t at = pause(random); at < duration; at += pause(random))
+    changes.push_back(at);
+  return changes;
+}
+
+Run loop(SimulatedHalfBus &bus, uint64_t duration, const std::function<void(uint8_t *, bool)> &cycle) {
+  Run run;
+  std::vector<uint64_t> changes = typist(duration);
+  for (size_t i = 0; i < changes.size(); i++)
+    bus.schedule(changes[i], 0, row, col, i % 2 == 0);
+
+  size_t seen = 0;
+  uint64_t next_frame = 0;
+  while (bus.now() < duration) {
+    uint64_t start = bus.now();
+    bool frame = start >= next_frame;
+    if (frame)
+      next_frame += frame_interval_ns;
+
+    uint8_t keys[key_bytes];
+    cycle(keys, frame);
+
+    // The key is down after an odd number of changes. Changes that came and
+    // went between two looks at the halves were never seen at all.
+    size_t due = seen;
+    while (due < changes.size() && changes[due] <= bus.now())
+      due++;
+    bool down = keys[row] & (1 << col);
+    if (due > seen && down == (due % 2 == 1)) {
+      run.latency_us.push_back((bus.now() - changes[due - 1]) / 1000.0);
+      run.missed += due - 1 - seen;
+      seen = due;
+    }
+    run.cycle_us.push_back((bus.now() - start) / 1000.0);
+  }
+  return run;
+}
+
+void report(const char *name, Run &run) {
+  std::sort(run.cycle_us.begin(), run.cycle_us.end());
+  std::sort(run.latency_us.begin(), run.latency_us.end());
+
+  auto at = [](const std::vector<double> &v, double q) {
+    return v.empty() ? 0.0 : v[std::min(v.size() - 1, size_t(v.size() * q))];
+  };
+
+  printf("%-9s %6zu cycles  cycle time p50 %8.1fus p99 %8.1fus max %8.1fus\n",
+         name, run.cycle_us.size(), at(run.cycle_us, 0.5), at(run.cycle_us, 0.99), at(run.cycle_us, 1));
+  printf("%-9s %6zu events  key latency p50 %7.1fus p99 %8.1fus max %8.1fus, %zu missed\n",
+         name, run.latency_us.size(), at(run.latency_us, 0.5), at(run.latency_us, 0.99), at(run.latency_us, 1),
+         run.missed);
+}
+
+}
+
+int main(int argc, char **argv) {
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 10;
+  uint32_t setup_us = argc > 2 ? atoi(argv[2]) : 50;
+  uint32_t byte_us = argc > 3 ? atoi(argv[3]) : 25;
+  uint32_t work_us = argc > 4 ? atoi(argv[4]) : 100;
+  uint64_t duration = seconds * 1000000000ull;
+
+  printf("Simulated %us: %uus per transfer + %uus per byte, %uus of plugin work per cycle,\n"
+         "%u LED banks per side sent every %ums\n\n",
+         seconds, setup_us, byte_us, work_us, banks_per_side, unsigned(frame_interval_ns / 1000000));
+
+  uint8_t leds[led_bytes] = {};
+
+  {
+    SimulatedHalfBus bus(setup_us * 1000, byte_us * 1000);
+    Run run = loop(bus, duration, [&](uint8_t *keys, bool frame) {
+      uint8_t right[key_bytes];
+      bus.read(0, keys, key_bytes);
+      bus.read(1, right, key_bytes);
+      bus.advance(work_us * 1000);
+      if (frame) {
+        for (uint8_t side = 0; side < sides; side++)
+          for (uint8_t bank = 0; bank < banks_per_side; bank++)
+            bus.write(side, bank, leds, led_bytes);
+      }
+    });
+    report("blocking", run);
+  }
+
+  {
+    SimulatedHalfBus bus(setup_us * 1000, byte_us * 1000);
+    Pipeline pipeline(bus);
+    pipeline.begin();
+    Run run = loop(bus, duration, [&](uint8_t *keys, bool frame) {
+      uint8_t right[key_bytes];
+      pipeline.takeKeys(0, keys);
+      pipeline.takeKeys(1, right);
+      bus.advance(work_us * 1000);
+      if (frame) {
+        for (uint8_t side = 0; side < sides; side++)
+          for (uint8_t bank = 0; bank < banks_per_side; bank++)
+            pipeline.queueLeds(side, bank, leds);
+      }
+    });
+    report("pipeline", run);
+
+    Pipeline::Stats stats = pipeline.stats();
+    printf("%-9s key frames %u, LED packets %u, coalesced %u, dropped %u\n", "pipeline",
+           stats.key_frames, stats.led_packets, stats.coalesced, stats.dropped);
+  }
+
+  return 0;
+}
@@ -0,0 +1,160 @@
+/* -*- mode: c++ -*-
+ * palette-frames -- LED RAM and link traffic, full color vs. palette frames
+ * Copyright (C) 2020  Dygma Lab S.L.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Plays the same LED scenarios into a full color framebuffer, sent as banks
+ * of 8 cRGB like the halves take them now, and into PaletteFramebuffer, and
+ * counts the RAM each needs and the bytes and transfers each puts on the link
+ * for one half. The full color side is given per-bank change tracking, which
+ * flatters it. The scenarios, 10 seconds at 40 frames per second each:
+ *
+ *   static     a colormap, set once
+ *   animated   the same, plus CapsLock and two LiveMacros keys breathing
+ *   layers     the animated one, with a different colormap every second
+ *
+ * Usage: palette-frames [setup_us] [byte_us]
+ */
+
+#include "PaletteFramebuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+namespace {
+
+struct cRGB {
+  uint8_t b, g, r;
+};
+
+// An assumption, change it to match the halves being modelled
+constexpr uint8_t leds = 72;
+constexpr uint8_t bank_size = 8;
+constexpr uint16_t frames = 400;
+
+typedef kaleidoscope::raise::PaletteFramebuffer<cRGB, leds> PaletteFrames;
+
+struct Link {
+  uint32_t bytes = 0;
+  uint32_t transfers = 0;
+
+  // Every transfer carries a one byte header: packet kind or bank
+  void send(uint8_t length) {
+    bytes += length + 1;
+    transfers++;
+  }
+};
+
+// Full color frames, sending the banks that changed
+class RgbFrames {
+ public:
+  explicit RgbFrames(uint8_t leds) : colors_(leds), dirty_((leds + bank_size - 1) / bank_size, true) {}
+
+  void set(uint8_t led, const cRGB &color) {
+    cRGB &current = colors_[led];
+    if (current.r == color.r && current.g == color.g && current.b == color.b)
+      return;
+    current = color;
+    dirty_[led / bank_size] = true;
+  }
+
+  void flush(Link &link) {
+    for (size_t bank = 0; bank < dirty_.size(); bank++) {
+      if (dirty_[bank])
+        link.send(bank_size * sizeof(cRGB));
+      dirty_[bank] = false;
+    }
+  }
+
+ private:
+  std::vector<cRGB> colors_;
+  std::vector<bool> dirty_;
+};
+
+const cRGB palette[16] = {
+  {0, 0, 0}, {0, 0, 255}, {0, 255, 0}, {255, 0, 0}, {0, 255, 255}, {255, 0, 255}, {255, 255, 0}, {255, 255, 255},
+  {0, 0, 128}, {0, 128, 0}, {128, 0, 0}, {0, 128, 128}, {128, 0, 128}, {128, 128, 0}, {128, 128, 128}, {64, 64, 64},
+};
+
+uint8_t colormapIndex(uint8_t layer, uint8_t led) {
+  return (led * 7 + layer * 5 + (led >> 3)) & 0x0f;
+}
+
+cRGB breathe(uint16_t frame, uint8_t hue) {
+  uint8_t level = (frame * 6 + hue) & 0xff;
+  level = level < 128 ? level * 2 : (255 - level) * 2;
+  return cRGB{uint8_t(level >> (hue & 1)), level, uint8_t(level >> 1)};
+}
+
+void run(const char *name, bool animated, bool layers, uint32_t setup_us, uint32_t byte_us) {
+  RgbFrames rgb(leds);
+  PaletteFrames indexed;
+  Link rgb_link, indexed_link;
+
+  for (uint8_t i = 0; i < 16; i++)
+    indexed.setPalette(i, palette[i]);
+
+  // LEDs showing CapsLock and two LiveMacros slots
+  const uint8_t highlights[] = {uint8_t(leds / 3), uint8_t(leds / 2), uint8_t(leds / 2 + 1)};
+
+  for (uint16_t frame = 0; frame < frames; frame++) {
+    uint8_t layer = layers ? frame / 40 : 0;
+    for (uint8_t led = 0; led < leds; led++) {
+      uint8_t index = colormapIndex(layer, led);
+      rgb.set(led, palette[index]);
+      indexed.setIndex(led, index);
+    }
+    if (animated) {
+      for (uint8_t i = 0; i < sizeof(highlights); i++) {
+        cRGB color = breathe(frame, i * 85);
+        rgb.set(highlights[i], color);
+        indexed.setOverride(highlights[i], color);
+      }
+    }
+
+    rgb.flush(rgb_link);
+    indexed.flush([&](PaletteFrames::Packet, uint8_t, const uint8_t *, uint8_t length) {
+      indexed_link.send(length);
+    });
+  }
+
+  auto time = [&](const Link & link) {
+    return (link.transfers * setup_us + link.bytes * byte_us) / 1000.0;
+  };
+
+  printf("%-9s full color %6u bytes %5u transfers %8.1fms | palette %6u bytes %5u transfers %8.1fms | %5.1f%% of the bytes\n",
+         name, rgb_link.bytes, rgb_link.transfers, time(rgb_link),
+         indexed_link.bytes, indexed_link.transfers, time(indexed_link),
+         100.0 * indexed_link.bytes / rgb_link.bytes);
+}
+
+}
+
+int main(int argc, char **argv) {
+  uint32_t setup_us = argc > 1 ? atoi(argv[1]) : 50;
+  uint32_t byte_us = argc > 2 ? atoi(argv[2]) : 25;
+
+  printf("%u LEDs per half, link: %uus per transfer + %uus per byte, %u frames\n", leds, setup_us, byte_us, frames);
+  printf("RAM per half: full color %zu bytes, palette %zu bytes (16 colors, indices, 8 overrides, change tracking)\n\n",
+         size_t(leds) * sizeof(cRGB), sizeof(PaletteFrames));
+
+  run("static", false, false, setup_us, byte_us);
+  run("animated", true, false, setup_us, byte_us);
+  run("layers", true, true, setup_us, byte_us);
+  return 0;
+}
@@ -0,0 +1,328 @@
+#!/usr/bin/env python3
+#
+# Build a Raise EEPROM image from a configuration file, and write it to a
+# keyboard in one eeprom.contents transfer.
+#
+# Usage: eeprom-image.py build config.json image.bin
+#        eeprom-image.py write [--port /dev/ttyACM0] image.bin
+#        eeprom-image.py layout
+#
+# The configuration is JSON, every field is optional:
+#
+#   default_layer  layer to start on (0)
+#   only_custom    ignore the built-in keymap, use the EEPROM layers only (true)
+#   led_mode       PersistentLEDMode index (0, the colormap)
+#   idle_timeout   PersistentIdleLEDs timeout in seconds (600)
+#   keymap         per layer, KEYS_PER_LAYER raw Key values (flags << 8 | keycode)
+#   palette        16 [r, g, b] colors
+#   colormap       per layer, LED_COUNT palette indices
+#   protocol       "nkro" or "boot", unset keeps the firmware default
+#   profile        profile active after boot (0)
+#   macros         [{"profile": 0, "slot": 0, "events": [[key, pressed], ...]}]
+#
+# Layers, keys and LEDs left out stay erased (0xff), which the firmware reads
+# as transparent keys, or as "not set" for the settings.
+#
+# LAYOUT below is the host copy of the slices the firmware requests, in the
+# order it requests them: the onSetup() slices of the plugins, in
+# KALEIDOSCOPE_INIT_PLUGINS order, then the ones from setup() in
+# Raise-Firmware.ino. It has to change whenever those do.
+#
+# EEPROMSettings computes a CRC of the layout at boot: a CRC-32 of the size of
+# every requested slice, as the uint16 requestSlice() is given. The header
+# keeps its low 16 bits, and settings.crc reports the one computed this boot.
+# "build" puts the CRC of LAYOUT in the header. "write" compares it with the
+# keyboard's settings.crc, and the layout size with eeprom.free, before
+# writing, so a layout that drifted from the firmware is refused rather than
+# written over the wrong slices. Even a change that keeps the total size, like
+# two slices trading bytes, changes the CRC. The version byte is left erased
+# by "build", and "write" keeps the keyboard's.
+#
+# Needs pyserial for "write".
+
+import argparse
+import json
+import re
+import struct
+import sys
+import time
+import zlib
+
+FOCUS_END = b"\r\n.\r\n"
+
+LAYERS = 10
+KEYS_PER_LAYER = 80
+LED_COUNT = 132
+PALETTE_SIZE = 16
+
+# StoragePool
+POOL_ENTRIES = 16
+POOL_LIVE_MACROS = 0
+
+# LiveMacros, as RaiseLiveMacros is configured
+MACRO_MAX_EVENTS = 14
+MACROS_IN_EEPROM = 6
+MACRO_KEY_PRESSED = 0x80
+# The fixed slots LiveMacros had before the StoragePool, now only padding
+MACRO_LEGACY_SIZE = MACROS_IN_EEPROM * (MACRO_MAX_EVENTS * 2 + 1) + 4
+
+# ProfileBanks
+ITEMS_PER_PROFILE = 8
+LAYERS_PER_PROFILE = 5
+
+# The directory, and every profile's EEPROM macros at their longest
+POOL_SIZE = POOL_ENTRIES * 4 + LAYERS // LAYERS_PER_PROFILE * MACROS_IN_EEPROM * (MACRO_MAX_EVENTS * 2 + 1)
+
+HID_BOOT_PROTOCOL = 0
+HID_REPORT_PROTOCOL = 1
+
+KEY_USAGE_VERSION = 1
+
+# EEPROMScrubber
+SCRUBBER_RANGES = 8
+
+
+class ConfigError(Exception):
+    pass
+
+
+# -- Slices -------------------------------------------------------------------
+
+def settings_header(config):
+    layer = config.get("default_layer", 0)
+    if not 0 <= layer < LAYERS:
+        raise ConfigError("default_layer out of range")
+    flags = layer | (0x80 if config.get("only_custom", True) else 0)
+    return bytes([flags, 0xff]) + struct.pack("<H", layout_crc())
+
+
+def led_mode(config):
+    if "led_mode" not in config:
+        return b"\xff"
+    return bytes([config["led_mode"]])
+
+
+def idle_timeout(config):
+    return struct.pack("<H", config.get("idle_timeout", 600))
+
+
+def legacy_macros(config):
+    # Erased slots, nothing for the firmware to import
+    return b"\xff" * MACRO_LEGACY_SIZE
+
+
+def keymap(config):
+    layers = config.get("keymap", [])
+    if len(layers) > LAYERS:
+        raise ConfigError("keymap has more than %d layers" % LAYERS)
+    data = bytearray(b"\xff" * (LAYERS * KEYS_PER_LAYER * 2))
+    for layer, keys in enumerate(layers):
+        if len(keys) > KEYS_PER_LAYER:
+            raise ConfigError("keymap layer %d has more than %d keys" % (layer, KEYS_PER_LAYER))
+        for i, key in enumerate(keys):
+            # EEPROMKeymap stores the flags first
+            position = (layer * KEYS_PER_LAYER + i) * 2
+            data[position] = key >> 8
+            data[position + 1] = key & 0xff
+    return bytes(data)
+
+
+def palette(config):
+    colors = config.get("palette", [])
+    if len(colors) > PALETTE_SIZE:
+        raise ConfigError("palette has more than %d colors" % PALETTE_SIZE)
+    data = bytearray(b"\xff" * (PALETTE_SIZE * 3))
+    for i, color in enumerate(colors):
+        data[i * 3:i * 3 + 3] = bytes(color)
+    return bytes(data)
+
+
+def colormap(config):
+    layers = config.get("colormap", [])
+    if len(layers) > LAYERS:
+        raise ConfigError("colormap has more than %d layers" % LAYERS)
+    data = bytearray(b"\xff" * (LAYERS * LED_COUNT // 2))
+    for layer, indices in enumerate(layers):
+        if len(indices) > LED_COUNT:
+            raise ConfigError("colormap layer %d has more than %d LEDs" % (layer, LED_COUNT))
+        for led, index in enumerate(indices):
+            if not 0 <= index < PALETTE_SIZE:
+                raise ConfigError("colormap layer %d LED %d: no such palette color" % (layer, led))
+            # Two LEDs per byte, the even one in the high nibble
+            position = layer * LED_COUNT // 2 + led // 2
+            shift = 0 if led % 2 else 4
+            data[position] = (data[position] & ~(0x0f << shift)) | (index << shift)
+    return bytes(data)
+
+
+def storage_pool(config):
+    entries = []
+    blocks = b""
+    for macro in config.get("macros", []):
+        profile, slot, events = macro.get("profile", 0), macro["slot"], macro["events"]
+        if not 0 <= slot < MACROS_IN_EEPROM:
+            raise ConfigError("macro slot %d is not kept in EEPROM" % slot)
+        if not 0 <= profile < LAYERS // LAYERS_PER_PROFILE:
+            raise ConfigError("no profile %d" % profile)
+        if not 0 < len(events) <= MACRO_MAX_EVENTS:
+            raise ConfigError("macro %d/%d needs 1 to %d events" % (profile, slot, MACRO_MAX_EVENTS))
+
+        block = bytearray([len(events)])
+        for key, pressed in events:
+            block += bytes([(key >> 8) | (MACRO_KEY_PRESSED if pressed else 0), key & 0xff])
+        entries.append(struct.pack("<BBH", POOL_LIVE_MACROS, profile * ITEMS_PER_PROFILE + slot, len(block)))
+        blocks += block
+
+    if len(entries) > POOL_ENTRIES:
+        raise ConfigError("more than %d macros" % POOL_ENTRIES)
+    directory = b"".join(entries).ljust(POOL_ENTRIES * 4, b"\xff")
+    if len(directory) + len(blocks) > POOL_SIZE:
+        raise ConfigError("macros need %d bytes, the pool has %d" % (len(blocks), POOL_SIZE - len(directory)))
+    return (directory + blocks).ljust(POOL_SIZE, b"\xff")
+
+
+def keyboard_protocol(config):
+    protocols = {"boot": HID_BOOT_PROTOCOL, "nkro": HID_REPORT_PROTOCOL}
+    if "protocol" not in config:
+        return b"\xff"
+    if config["protocol"] not in protocols:
+        raise ConfigError("protocol is nkro or boot")
+    return bytes([protocols[config["protocol"]]])
+
+
+def key_usage(config):
+    return bytes([KEY_USAGE_VERSION]) + bytes(KEYS_PER_LAYER * 2)
+
+
+def profile_banks(config):
+    return bytes([config.get("profile", 0)])
+
+
+def scrubber_crcs(config):
+    # Erased: the firmware seals every range on its first pass
+    return b"\xff" * (SCRUBBER_RANGES * 2)
+
+
+LAYOUT = [
+    ("EEPROMSettings", 4, settings_header),
+    ("PersistentLEDMode", 1, led_mode),
+    ("PersistentIdleLEDs", 2, idle_timeout),
+    ("LiveMacros legacy slots", MACRO_LEGACY_SIZE, legacy_macros),
+    ("EEPROMKeymap", LAYERS * KEYS_PER_LAYER * 2, keymap),
+    ("LEDPaletteTheme palette", PALETTE_SIZE * 3, palette),
+    ("ColormapEffect", LAYERS * LED_COUNT // 2, colormap),
+    ("StoragePool", POOL_SIZE, storage_pool),
+    ("KeyboardProtocol", 1, keyboard_protocol),
+    ("KeyUsage", 1 + KEYS_PER_LAYER * 2, key_usage),
+    ("ProfileBanks", 1, profile_banks),
+    ("EEPROMScrubber", SCRUBBER_RANGES * 2, scrubber_crcs),
+]
+
+
+def layout_size():
+    return sum(size for _, size, _ in LAYOUT)
+
+
+def layout_crc():
+    # The header is not a requested slice, see above
+    sizes = b"".join(struct.pack("<H", size) for _, size, _ in LAYOUT[1:])
+    return zlib.crc32(sizes) & 0xffff
+
+
+def build(config):
+    image = b""
+    for name, size, encode in LAYOUT:
+        data = encode(config)
+        if len(data) != size:
+            raise ConfigError("%s encoded to %d bytes, the slice has %d" % (name, len(data), size))
+        image += data
+    return image
+
+
+# -- Device -------------------------------------------------------------------
+
+def focus(ser, command, timeout=10):
+    """Send a Focus command, return the reply without the terminating dot."""
+    ser.write(command.encode() + b"\n")
+    reply = b""
+    deadline = time.time() + timeout
+    while not reply.endswith(FOCUS_END):
+        if time.time() > deadline:
+            raise SystemExit("no reply to %s" % command.split()[0])
+        reply += ser.read(ser.in_waiting or 1)
+    return reply[:-len(FOCUS_END)].decode().strip()
+
+
+def write(port, image):
+    import serial
+
+    with serial.Serial(port, 9600, timeout=0.1) as ser:
+        # "computed/stored", the stored one may be left from an older layout
+        reply = focus(ser, "settings.crc")
+        match = re.match(r"(\d+)\s*/", reply)
+        if not match:
+            raise SystemExit("Unexpected settings.crc reply: %r" % reply)
+        firmware_crc = int(match.group(1)) & 0xffff
+        if firmware_crc != layout_crc():
+            raise SystemExit("The firmware's layout CRC is %04x, LAYOUT's is %04x: LAYOUT is out of date"
+                             % (firmware_crc, layout_crc()))
+
+        current = bytes(int(b) for b in focus(ser, "eeprom.contents").split())
+        used = len(current) - int(focus(ser, "eeprom.free"))
+        if used != len(image):
+            raise SystemExit("The firmware uses %d bytes of EEPROM, the image has %d: LAYOUT is out of date"
+                             % (used, len(image)))
+
+        # The firmware's own version
+        image = image[:1] + current[1:2] + image[2:]
+
+        start = time.time()
+        focus(ser, "eeprom.contents " + " ".join(str(b) for b in image), timeout=30)
+        written = time.time() - start
+
+        readback = bytes(int(b) for b in focus(ser, "eeprom.contents").split())[:len(image)]
+        expected, got = zlib.crc32(image), zlib.crc32(readback)
+        if got != expected:
+            raise SystemExit("EEPROM checksum mismatch: %08x != %08x" % (got, expected))
+
+    print("%d bytes written in %.2fs, crc %08x" % (len(image), written, expected))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build and write Raise EEPROM images.")
+    commands = parser.add_subparsers(dest="command")
+    build_parser = commands.add_parser("build", help="build an image from a configuration")
+    build_parser.add_argument("config")
+    build_parser.add_argument("image")
+    write_parser = commands.add_parser("write", help="write an image to a keyboard and verify it")
+    write_parser.add_argument("--port", default="/dev/ttyACM0")
+    write_parser.add_argument("image")
+    commands.add_parser("layout", help="show the slice layout")
+    args = parser.parse_args()
+
+    if args.command == "build":
+        with open(args.config) as f:
+            config = json.load(f)
+        try:
+            image = build(config)
+        except (ConfigError, KeyError, TypeError, ValueError) as e:
+            sys.exit("%s: %s" % (args.config, e))
+        with open(args.image, "wb") as f:
+            f.write(image)
+        print("%s: %d bytes, crc %08x" % (args.image, len(image), zlib.crc32(image)))
+    elif args.command == "write":
+        with open(args.image, "rb") as f:
+            write(args.port, f.read())
+    elif args.command == "layout":
+        offset = 0
+        for name, size, _ in LAYOUT:
+            print("%5d %5d  %s" % (offset, size, name))
+            offset += size
+        print("%5d        total, crc %04x" % (offset, layout_crc()))
+    else:
+        parser.print_help()
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+#
+# Measure how fast the big Focus replies come back from a Raise, with the
+# FocusBuffer output buffering off and on.
+#
+# Usage: focus-throughput.py [--port /dev/ttyACM0] [--runs N] [command ...]
+#
+# For each command, the reply is read --runs times with focus.buffer 0 and
+# again with focus.buffer 1, and the best time of each is reported in bytes
+# per second. Buffering is left on afterwards. Needs pyserial.
+
+import argparse
+import time
+
+import serial
+
+FOCUS_END = b"\r\n.\r\n"
+DEFAULT_COMMANDS = ["eeprom.contents", "lv.map", "lv.mapraw", "storage.directory"]
+
+
+def focus(ser, command, timeout=10):
+    """Send a Focus command, return the raw reply without the terminator."""
+    ser.write(command.encode() + b"\n")
+    reply = b""
+    deadline = time.time() + timeout
+    while not reply.endswith(FOCUS_END):
+        if time.time() > deadline:
+            raise SystemExit("no reply to %s" % command)
+        reply += ser.read(ser.in_waiting or 1)
+    return reply[:-len(FOCUS_END)]
+
+
+def measure(ser, command, runs):
+    best = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        size = len(focus(ser, command))
+        elapsed = time.perf_counter() - start
+        if best is None or elapsed < best[1]:
+            best = (size, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Time Focus replies with and without output buffering.")
+    parser.add_argument("--port", default="/dev/ttyACM0")
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("commands", nargs="*", default=DEFAULT_COMMANDS)
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, 9600, timeout=0.1) as ser:
+        print("%-20s %8s %12s %12s %8s" % ("command", "bytes", "unbuffered", "buffered", "speedup"))
+        for command in args.commands:
+            focus(ser, "focus.buffer 0")
+            size, before = measure(ser, command, args.runs)
+            focus(ser, "focus.buffer 1")
+            _, after = measure(ser, command, args.runs)
+            print("%-20s %8d %10.0f/s %10.0f/s %7.1fx" % (
+                command, size, size / before, size / after, before / after))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+# Per plugin RAM / flash / EEPROM report for a Raise firmware build.
+#
+# Usage: plugin-size.py <firmware.elf> [Plugin=eeprom_bytes ...]
+#
+# RAM and flash are taken from the symbol table of the ELF file: symbols are
+# grouped by the plugin class they belong to (kaleidoscope::plugin::X and
+# Dygma::plugin::X), everything else goes to the "other" bucket. The global
+# plugin instances, like LiveMacros, have plain names: the ones listed in
+# KALEIDOSCOPE_INIT_PLUGINS in the sketch are mapped to their class, from the
+# declarations in the sketch and the headers next to it. Instances of
+# Kaleidoscope plugins are named after their class, but for LIBRARY_INSTANCES.
+#
+# EEPROM slices are requested at runtime, so they are passed on the command
+# line (the Makefile asks the keyboard for them when one is connected).
+
+import glob
+import os
+import re
+import subprocess
+import sys
+
+NM = os.environ.get("NM", "arm-none-eabi-nm")
+PLUGIN_RE = re.compile(r"(?:kaleidoscope|Dygma)::plugin::(\w+)")
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SKETCH = os.path.join(ROOT, "Raise-Firmware.ino")
+
+# Symbols are sorted by the section nm reports them in: code and read-only
+# data live in flash, bss lives in RAM, initialised data lives in both. Weak
+# symbols, like template and inline code, are sorted the same way.
+LIBRARY_INSTANCES = {"Focus": "FocusSerial"}
+
+FLASH_SECTIONS = (".text", ".rodata")
+RAM_SECTIONS = (".bss",)
+DATA_SECTIONS = (".data",)
+
+
+def strip_comments(source):
+    source = re.sub(r"/\*.*?\*/", "", source, flags=re.S)
+    return re.sub(r"//[^\n]*", "", source)
+
+
+def plugin_instances():
+    """Map the instance names in KALEIDOSCOPE_INIT_PLUGINS to plugin classes."""
+    with open(SKETCH) as f:
+        sketch = strip_comments(f.read())
+    headers = ""
+    for header in glob.glob(os.path.join(ROOT, "*.h")):
+        with open(header) as f:
+            headers += strip_comments(f.read())
+
+    # typedef LiveMacrosPlugin<14, 8, 6> RaiseLiveMacros;
+    typedefs = dict((name, base) for base, name in
+                    re.findall(r"typedef\s+(?:\w+::)*(\w+)\s*(?:<[^;]*>)?\s+(\w+)\s*;", headers))
+    # extern Dygma::plugin::RaiseLiveMacros LiveMacros; or, in the sketch,
+    # kaleidoscope::plugin::EEPROMPadding LegacyLiveMacros(178);
+    declared = dict(LIBRARY_INSTANCES)
+    for kind, name in re.findall(r"^\s*(?:extern\s+)?((?:\w+::)+\w+)\s+(\w+)\s*[;(]",
+                                 headers + sketch, flags=re.M):
+        kind = kind.split("::")[-1]
+        declared[name] = typedefs.get(kind, kind)
+
+    listed = re.search(r"KALEIDOSCOPE_INIT_PLUGINS\s*\((.*?)\);", sketch, flags=re.S)
+    if not listed:
+        return {}
+    return dict((name, declared.get(name, name)) for name in re.findall(r"\w+", listed.group(1)))
+
+
+def owner(name, instances):
+    match = PLUGIN_RE.search(name)
+    if match:
+        return match.group(1)
+    # Static members of an instance's class are demangled with the class, the
+    # instance itself is a plain name
+    return instances.get(name, "other")
+
+
+def nm_symbols(elf):
+    """(name, size, section) for every symbol with a size."""
+    out = subprocess.check_output([NM, "-C", "-S", "--format=sysv", elf])
+    for line in out.decode().splitlines():
+        fields = line.split("|")
+        if len(fields) < 7 or not fields[4].strip():
+            continue
+        # Name|Value|Class|Type|Size|Line|Section, a name may have a | in it
+        name = "|".join(fields[:-6]).strip()
+        yield name, int(fields[-3], 16), fields[-1].strip()
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: %s <firmware.elf> [Plugin=eeprom_bytes ...]" % sys.argv[0])
+
+    eeprom = {}
+    for arg in sys.argv[2:]:
+        name, size = arg.split("=")
+        eeprom[name] = int(size)
+
+    instances = plugin_instances()
+    totals = {}
+    for name, size, section in nm_symbols(sys.argv[1]):
+        plugin = owner(name, instances)
+        ram, flash = totals.setdefault(plugin, [0, 0])
+        if section.startswith(FLASH_SECTIONS):
+            flash += size
+        elif section.startswith(RAM_SECTIONS):
+            ram += size
+        elif section.startswith(DATA_SECTIONS):
+            ram += size
+            flash += size
+        totals[plugin] = [ram, flash]
+
+    print("%-28s %8s %8s %8s" % ("plugin", "ram", "flash", "eeprom"))
+    for name in sorted(totals, key=lambda n: (n == "other", n)):
+        ram, flash = totals[name]
+        print("%-28s %8d %8d %8s" % (name, ram, flash, eeprom.get(name, "-")))
+
+
+if __name__ == "__main__":
+    main()
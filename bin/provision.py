@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+#
+# Flash a batch of Raise keyboards at once, keeping their EEPROM contents.
+#
+# For every Raise attached to this machine, in parallel:
+#   1. back up the EEPROM through Focus (eeprom.contents)
+#   2. reset it into the bootloader with the 1200 baud touch
+#   3. flash the firmware with bossac, and read it back to verify it
+#   4. wait for the keyboard to come back, restore the EEPROM and read it back
+#      to verify it
+# and report how long each step took on each device.
+#
+# Devices are tracked by their USB port (the sysfs device name, like 1-2.3),
+# since the tty name changes when a keyboard reboots into the bootloader.
+#
+# With --fake N, no hardware is touched: N simulated keyboards are created on
+# pseudo terminals. They speak Focus, notice the 1200 baud touch, and lose
+# their EEPROM when flashed, like the real thing.
+#
+# Linux only. Needs pyserial.
+
+import argparse
+import concurrent.futures
+import glob
+import os
+import random
+import select
+import subprocess
+import sys
+import termios
+import threading
+import time
+import tty
+import zlib
+
+import serial
+
+DYGMA_VID = "1209"
+RAISE_PID = "2201"
+RAISE_BOOTLOADER_PID = "2200"
+
+FOCUS_END = b"\r\n.\r\n"
+PORT_TIMEOUT = 15
+
+
+class ProvisionError(Exception):
+    pass
+
+
+# -- Focus --------------------------------------------------------------------
+
+def focus(port, command, timeout=10):
+    """Send a Focus command, return the reply without the terminating dot."""
+    with serial.Serial(port, 9600, timeout=0.1) as ser:
+        ser.write(command.encode() + b"\n")
+        reply = b""
+        deadline = time.time() + timeout
+        while not reply.endswith(FOCUS_END):
+            if time.time() > deadline:
+                raise ProvisionError("no reply to %s on %s" % (command.split()[0], port))
+            reply += ser.read(4096)
+    return reply[:-len(FOCUS_END)].decode().strip()
+
+
+def touch_1200(port):
+    """Opening the port at 1200 baud makes the Raise reboot into its bootloader."""
+    ser = serial.Serial(port, 1200)
+    ser.close()
+
+
+# -- Real hardware ------------------------------------------------------------
+
+class UsbBackend:
+    def __init__(self, bossac):
+        self.bossac = bossac
+
+    def ports(self):
+        """Map USB port -> (tty, pid) for every Dygma device attached."""
+        found = {}
+        for tty_dir in glob.glob("/sys/class/tty/ttyACM*"):
+            interface = os.path.realpath(os.path.join(tty_dir, "device"))
+            usb_device = os.path.dirname(interface)
+            try:
+                with open(os.path.join(usb_device, "idVendor")) as f:
+                    vid = f.read().strip()
+                with open(os.path.join(usb_device, "idProduct")) as f:
+                    pid = f.read().strip()
+            except IOError:
+                continue
+            if vid == DYGMA_VID and pid in (RAISE_PID, RAISE_BOOTLOADER_PID):
+                found[os.path.basename(usb_device)] = ("/dev/" + os.path.basename(tty_dir), pid)
+        return found
+
+    def flash(self, port, firmware):
+        # -v reads the flash back, bossac exits with an error on a mismatch
+        try:
+            subprocess.check_output(
+                [self.bossac, "-i", "-d", "--port=" + port, "-e", "-w", "-v", firmware, "-R"],
+                stderr=subprocess.STDOUT)
+        except subprocess.CalledProcessError as e:
+            output = e.output.decode(errors="replace").strip().splitlines()
+            raise ProvisionError("bossac failed (%d): %s" % (e.returncode, output[-1] if output else "no output"))
+
+
+# -- Simulated hardware -------------------------------------------------------
+
+class FakeRaise(threading.Thread):
+    """A Raise on a pseudo terminal: Focus eeprom.contents, 1200 baud touch, flashing."""
+
+    EEPROM_SIZE = 1024
+
+    def __init__(self, usb_path):
+        threading.Thread.__init__(self, daemon=True)
+        self.usb_path = usb_path
+        self.eeprom = bytearray(random.getrandbits(8) for _ in range(self.EEPROM_SIZE))
+        self.lock = threading.Lock()
+        self.master = self.slave = None
+        self.port = None
+        self.pid = None
+        self.flashed = threading.Event()
+        self.enumerate(RAISE_PID)
+
+    def enumerate(self, pid):
+        with self.lock:
+            self.master, self.slave = os.openpty()
+            tty.setraw(self.slave)
+            self.port = os.ttyname(self.slave)
+            self.pid = pid
+
+    def disconnect(self):
+        with self.lock:
+            os.close(self.master)
+            os.close(self.slave)
+            self.port = None
+
+    def run(self):
+        line = b""
+        while True:
+            if self.pid == RAISE_BOOTLOADER_PID:
+                self.flashed.wait()
+                self.flashed.clear()
+                time.sleep(0.2)
+                self.enumerate(RAISE_PID)
+                continue
+
+            if termios.tcgetattr(self.slave)[4] == termios.B1200:
+                self.disconnect()
+                time.sleep(0.2)
+                self.enumerate(RAISE_BOOTLOADER_PID)
+                continue
+
+            ready, _, _ = select.select([self.master], [], [], 0.05)
+            if not ready:
+                continue
+            line += os.read(self.master, 4096)
+            while b"\n" in line:
+                command, line = line.split(b"\n", 1)
+                os.write(self.master, self.handle(command.decode().split()) + FOCUS_END)
+
+    def handle(self, words):
+        if words[:1] == ["eeprom.contents"]:
+            if len(words) == 1:
+                return " ".join(str(b) for b in self.eeprom).encode()
+            for i, value in enumerate(words[1:self.EEPROM_SIZE + 1]):
+                self.eeprom[i] = int(value)
+        return b""
+
+    def flash(self):
+        # bossac -e erases the whole flash, and with it the emulated EEPROM
+        self.eeprom = bytearray(b"\xff" * self.EEPROM_SIZE)
+        self.disconnect()
+        self.flashed.set()
+
+
+class FakeBackend:
+    def __init__(self, count):
+        self.devices = {}
+        for i in range(count):
+            device = FakeRaise("fake-%d" % i)
+            device.start()
+            self.devices[device.usb_path] = device
+
+    def ports(self):
+        found = {}
+        for usb_path, device in self.devices.items():
+            with device.lock:
+                if device.port:
+                    found[usb_path] = (device.port, device.pid)
+        return found
+
+    def flash(self, port, firmware):
+        for device in self.devices.values():
+            if device.port == port:
+                device.flash()
+                return
+        raise ProvisionError("no fake device on " + port)
+
+
+# -- Provisioning -------------------------------------------------------------
+
+def wait_for(backend, usb_path, pid):
+    deadline = time.time() + PORT_TIMEOUT
+    while time.time() < deadline:
+        port = backend.ports().get(usb_path)
+        if port and port[1] == pid:
+            # Give udev a moment to set the permissions of the new tty
+            time.sleep(0.2)
+            return port[0]
+        time.sleep(0.1)
+    raise ProvisionError("device did not come back")
+
+
+def provision(backend, usb_path, firmware):
+    timings = []
+    start = time.time()
+
+    def step(name, function, *args):
+        t = time.time()
+        result = function(*args)
+        timings.append((name, time.time() - t))
+        return result
+
+    port = wait_for(backend, usb_path, RAISE_PID)
+    backup = step("backup", focus, port, "eeprom.contents")
+    if not backup:
+        raise ProvisionError("empty EEPROM backup")
+
+    step("reset", touch_1200, port)
+    bootloader = step("bootloader", wait_for, backend, usb_path, RAISE_BOOTLOADER_PID)
+    step("flash", backend.flash, bootloader, firmware)
+    port = step("reboot", wait_for, backend, usb_path, RAISE_PID)
+
+    step("restore", focus, port, "eeprom.contents " + backup)
+    readback = step("verify", focus, port, "eeprom.contents")
+    expected = zlib.crc32(backup.encode())
+    got = zlib.crc32(readback.encode())
+    if got != expected:
+        raise ProvisionError("EEPROM checksum mismatch: %08x != %08x" % (got, expected))
+
+    timings.append(("total", time.time() - start))
+    return expected, timings
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flash every attached Raise in parallel, keeping its EEPROM.")
+    parser.add_argument("firmware", help="firmware .bin to flash")
+    parser.add_argument("--bossac", default="bossac", help="bossac binary to flash with")
+    parser.add_argument("--jobs", type=int, default=8, help="devices to provision at the same time")
+    parser.add_argument("--fake", type=int, metavar="N", help="provision N simulated keyboards instead")
+    args = parser.parse_args()
+
+    backend = FakeBackend(args.fake) if args.fake else UsbBackend(args.bossac)
+    devices = sorted(usb for usb, (_, pid) in backend.ports().items() if pid == RAISE_PID)
+    if not devices:
+        sys.exit("No Raise found")
+    print("Provisioning %d device(s): %s" % (len(devices), " ".join(devices)))
+
+    failures = 0
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        jobs = {pool.submit(provision, backend, usb, args.firmware): usb for usb in devices}
+        for job in concurrent.futures.as_completed(jobs):
+            usb = jobs[job]
+            try:
+                crc, timings = job.result()
+            except (ProvisionError, serial.SerialException) as e:
+                failures += 1
+                print("%-12s FAILED: %s" % (usb, e))
+                continue
+            print("%-12s ok  eeprom crc %08x  %s" % (
+                usb, crc, "  ".join("%s %.2fs" % timing for timing in timings)))
+
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+#
+# Record a real typing session into the trace format the replay benchmark
+# reads. The traces checked in under bench/synthetic-corpus/ are not
+# recordings: one is scripted by hand, the other typed by --text below.
+#
+# Usage: record-trace.py /dev/input/eventN > session.trace
+#        record-trace.py --text prose.txt [--wpm 70] [--seed 1] > prose.trace
+#
+# Reads key presses and releases from a Linux input device until interrupted,
+# and writes one "<milliseconds> <down|up> <HID usage>" line per event. Keys
+# without a HID keyboard usage in the table below are skipped. Needs read
+# access to the event device (root, or the input group).
+#
+# With --text, types a text file instead, for a corpus that does not depend on
+# someone's typing session: presses come at the given speed with random gaps
+# and hold times, so fast pairs overlap, and capitals are typed with Left
+# Shift. The same seed gives the same trace.
+
+import argparse
+import random
+import struct
+import sys
+
+EVENT = struct.Struct("llHHi")
+EV_KEY = 1
+
+# Linux key code -> HID keyboard usage
+LINUX_TO_HID = {
+    1: 0x29, 14: 0x2a, 15: 0x2b, 28: 0x28, 57: 0x2c, 58: 0x39,
+    12: 0x2d, 13: 0x2e, 26: 0x2f, 27: 0x30, 43: 0x31, 39: 0x33,
+    40: 0x34, 41: 0x35, 51: 0x36, 52: 0x37, 53: 0x38, 86: 0x64,
+    29: 0xe0, 42: 0xe1, 56: 0xe2, 125: 0xe3,
+    97: 0xe4, 54: 0xe5, 100: 0xe6, 126: 0xe7,
+    102: 0x4a, 104: 0x4b, 111: 0x4c, 107: 0x4d, 109: 0x4e,
+    106: 0x4f, 105: 0x50, 108: 0x51, 103: 0x52, 127: 0x65,
+    69: 0x53, 70: 0x47,
+}
+# Letters, in HID order
+for usage, code in enumerate([30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38, 50,
+                              49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44]):
+    LINUX_TO_HID[code] = 0x04 + usage
+# 1..9, 0
+for usage, code in enumerate(range(2, 12)):
+    LINUX_TO_HID[code] = 0x1e + usage
+# F1..F10, F11, F12
+for usage, code in enumerate(range(59, 69)):
+    LINUX_TO_HID[code] = 0x3a + usage
+LINUX_TO_HID[87] = 0x44
+LINUX_TO_HID[88] = 0x45
+
+
+HID_LEFT_SHIFT = 0xe1
+
+# Characters typed with --text, and the HID usage of their key
+TEXT_KEYS = {" ": 0x2c, "\n": 0x28, "-": 0x2d, ";": 0x33, "'": 0x34, ",": 0x36, ".": 0x37, "/": 0x38}
+for usage, char in enumerate("abcdefghijklmnopqrstuvwxyz"):
+    TEXT_KEYS[char] = 0x04 + usage
+for usage, char in enumerate("1234567890"):
+    TEXT_KEYS[char] = 0x1e + usage
+SHIFTED_KEYS = {"?": "/", ":": ";", "\"": "'", "!": "1", "(": "9", ")": "0"}
+
+
+def type_text(path, wpm, seed):
+    with open(path) as f:
+        text = f.read()
+    rng = random.Random(seed)
+    # Five characters to the word
+    interval = 60000.0 / (wpm * 5)
+
+    events = []
+    ms = 0.0
+    for char in text:
+        shifted = char.isupper() or char in SHIFTED_KEYS
+        key = TEXT_KEYS.get(SHIFTED_KEYS.get(char, char.lower()))
+        if key is None:
+            continue
+        hold = rng.uniform(60, 110)
+        if shifted:
+            events.append((ms, True, HID_LEFT_SHIFT))
+            ms += rng.uniform(20, 40)
+        events.append((ms, True, key))
+        events.append((ms + hold, False, key))
+        if shifted:
+            events.append((ms + hold + rng.uniform(5, 20), False, HID_LEFT_SHIFT))
+            ms += hold
+        ms += max(25.0, rng.gauss(interval, interval / 3))
+
+    print("# Typed from %s at %d wpm, seed %d, by record-trace.py --text" % (path, wpm, seed))
+    for ms, down, key in sorted(events, key=lambda event: event[0]):
+        print("%d %s 0x%02x" % (ms, "down" if down else "up", key))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Record or synthesize a replay benchmark trace.")
+    parser.add_argument("device", nargs="?", help="a Linux input device to record from")
+    parser.add_argument("--text", help="type this text file instead")
+    parser.add_argument("--wpm", type=int, default=70)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if args.text:
+        type_text(args.text, args.wpm, args.seed)
+        return
+    if not args.device:
+        parser.error("a device or --text is needed")
+
+    start = None
+    print("# Recorded from %s" % args.device)
+    with open(args.device, "rb") as device:
+        try:
+            while True:
+                sec, usec, kind, code, value = EVENT.unpack(device.read(EVENT.size))
+                # value 2 is autorepeat, the keyboard never sends those
+                if kind != EV_KEY or value not in (0, 1) or code not in LINUX_TO_HID:
+                    continue
+                ms = sec * 1000 + usec // 1000
+                if start is None:
+                    start = ms
+                print("%d %s 0x%02x" % (ms - start, "down" if value else "up", LINUX_TO_HID[code]))
+                sys.stdout.flush()
+        except KeyboardInterrupt:
+            pass
+
+
+if __name__ == "__main__":
+    main()